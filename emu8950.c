@@ -5,10 +5,21 @@
  */
 #include "emu8950.h"
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef __cplusplus
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
 #ifndef INLINE
 #if defined(_MSC_VER)
 #define INLINE __inline
@@ -21,8 +32,17 @@
 
 #define _PI_ 3.14159265358979323846264338327950288
 
+/* In a C++ build, every lookup table is generated at compile time and placed in read-only data. */
+#ifdef __cplusplus
+#define TABLE_CONST constexpr
+#define TABLE_FUNC static constexpr
+#else
+#define TABLE_CONST const
+#define TABLE_FUNC static
+#endif
+
 enum __OPL_EG_STATE { ATTACK, DECAY, SUSTAIN, RELEASE, UNKNOWN };
-enum __OPL_TYPE { TYPE_Y8950 = 0, TYPE_YM3526, TYPE_YM3812, TYPE_MAX };
+enum __OPL_TYPE { TYPE_Y8950 = 0, TYPE_YM3526, TYPE_YM3812, TYPE_YMF262, TYPE_MAX };
 
 /* phase increment counter */
 #define DP_BITS 20
@@ -51,7 +71,7 @@ enum __OPL_TYPE { TYPE_Y8950 = 0, TYPE_YM3526, TYPE_YM3812, TYPE_MAX };
 
 /* clang-format off */
 /* exp_table[x] = round((exp2((double)x / 256.0) - 1) * 1024) */
-static uint16_t exp_table[256] = {
+static TABLE_CONST uint16_t exp_table[256] = {
 0,    3,    6,    8,    11,   14,   17,   20,   22,   25,   28,   31,   34,   37,   40,   42,
 45,   48,   51,   54,   57,   60,   63,   66,   69,   72,   75,   78,   81,   84,   87,   90,
 93,   96,   99,   102,  105,  108,  111,  114,  117,  120,  123,  126,  130,  133,  136,  139,
@@ -70,7 +90,7 @@ static uint16_t exp_table[256] = {
 937,  942,  948,  953,  959,  964,  969,  975,  980,  986,  991,  996, 1002, 1007, 1013, 1018
 };
 /* logsin_table[x] = round(-log2(sin((x + 0.5) * PI / (PG_WIDTH / 4) / 2)) * 256) */
-static uint16_t logsin_table[PG_WIDTH / 4] = {
+static TABLE_CONST uint16_t logsin_table[PG_WIDTH / 4] = {
 2137, 1731, 1543, 1419, 1326, 1252, 1190, 1137, 1091, 1050, 1013, 979,  949,  920,  894,  869, 
 846,  825,  804,  785,  767,  749,  732,  717,  701,  687,  672,  659,  646,  633,  621,  609, 
 598,  587,  576,  566,  556,  546,  536,  527,  518,  509,  501,  492,  484,  476,  468,  461,
@@ -90,16 +110,15 @@ static uint16_t logsin_table[PG_WIDTH / 4] = {
 };
 /* clang-format on */
 
-static uint16_t wave_table_map[4][PG_WIDTH];
-
 /* pitch modulator */
 #define PM_PG_BITS 3
 #define PM_PG_WIDTH (1 << PM_PG_BITS)
 #define PM_DP_BITS 22
 #define PM_DP_WIDTH (1 << PM_DP_BITS)
+#define PM_STEP(phase) ((phase) >> (PM_DP_BITS - PM_PG_BITS))
 
 /* offset to fnum, rough approximation of 14 cents depth. */
-static int8_t pm_table[8][PM_PG_WIDTH] = {
+static TABLE_CONST int8_t pm_table[8][PM_PG_WIDTH] = {
     {0, 0, 0, 0, 0, 0, 0, 0},    // fnum = 000xxxxx
     {0, 0, 1, 0, 0, 0, -1, 0},   // fnum = 001xxxxx
     {0, 1, 2, 1, 0, -1, -2, -1}, // fnum = 010xxxxx
@@ -113,7 +132,8 @@ static int8_t pm_table[8][PM_PG_WIDTH] = {
 /* amplitude lfo table */
 /* The following envelop pattern is verified on real YM2413. */
 /* each element repeates 64 cycles */
-static uint8_t am_table[210] = {0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,  1,  1,  1,  //
+#define AM_DP_WIDTH (210 * 64)
+static TABLE_CONST uint8_t am_table[210] = {0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,  1,  1,  1,  //
                                 2,  2,  2,  2,  2,  2,  2,  2,  3,  3,  3,  3,  3,  3,  3,  3,  //
                                 4,  4,  4,  4,  4,  4,  4,  4,  5,  5,  5,  5,  5,  5,  5,  5,  //
                                 6,  6,  6,  6,  6,  6,  6,  6,  7,  7,  7,  7,  7,  7,  7,  7,  //
@@ -130,29 +150,36 @@ static uint8_t am_table[210] = {0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,
                                 1,  1,  1,  1,  1,  1,  1,  1,  0,  0,  0,  0,  0,  0,  0};
 
 /* envelope decay increment step table */
-static uint8_t eg_step_tables[4][8] = {
+static TABLE_CONST uint8_t eg_step_tables[4][8] = {
     {0, 1, 0, 1, 0, 1, 0, 1},
     {0, 1, 0, 1, 1, 1, 0, 1},
     {0, 1, 1, 1, 0, 1, 1, 1},
     {0, 1, 1, 1, 1, 1, 1, 1},
 };
-static uint8_t eg_step_tables_fast[4][8] = {
+static TABLE_CONST uint8_t eg_step_tables_fast[4][8] = {
     {1, 1, 1, 1, 1, 1, 1, 1},
     {1, 1, 1, 2, 1, 1, 1, 2},
     {1, 2, 1, 2, 1, 2, 1, 2},
     {1, 2, 2, 2, 1, 2, 2, 2},
 };
 
-static uint32_t ml_table[16] = {1,     1 * 2, 2 * 2,  3 * 2,  4 * 2,  5 * 2,  6 * 2,  7 * 2,
-                                8 * 2, 9 * 2, 10 * 2, 10 * 2, 12 * 2, 12 * 2, 15 * 2, 15 * 2};
+static TABLE_CONST uint32_t ml_table[16] = {1,     1 * 2, 2 * 2,  3 * 2,  4 * 2,  5 * 2,  6 * 2,  7 * 2,
+                                           8 * 2, 9 * 2, 10 * 2, 10 * 2, 12 * 2, 12 * 2, 15 * 2, 15 * 2};
+
+/* eg counter shift for each eg rate (high 4 bits); rates 12 and above advance every sample */
+static TABLE_CONST uint8_t eg_shift_table[16] = {0, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 0, 0, 0};
 
 #define dB2(x) ((x) * 2)
-static double kl_table[16] = {dB2(0.000),  dB2(9.000),  dB2(12.000), dB2(13.875), dB2(15.000), dB2(16.125),
-                              dB2(16.875), dB2(17.625), dB2(18.000), dB2(18.750), dB2(19.125), dB2(19.500),
-                              dB2(19.875), dB2(20.250), dB2(20.625), dB2(21.000)};
+static TABLE_CONST double kl_table[16] = {dB2(0.000),  dB2(9.000),  dB2(12.000), dB2(13.875), dB2(15.000),
+                                          dB2(16.125), dB2(16.875), dB2(17.625), dB2(18.000), dB2(18.750),
+                                          dB2(19.125), dB2(19.500), dB2(19.875), dB2(20.250), dB2(20.625),
+                                          dB2(21.000)};
 
+#ifndef __cplusplus
+static uint16_t wave_table_map[8][PG_WIDTH];
 static uint32_t tll_table[8 * 16][1 << TL_BITS][4];
 static int32_t rks_table[2][32][2];
+#endif
 
 #define min(i, j) (((i) < (j)) ? (i) : (j))
 #define max(i, j) (((i) > (j)) ? (i) : (j))
@@ -182,23 +209,12 @@ static double blackman(double x) { return 0.42 - 0.5 * cos(2 * _PI_ * x) + 0.08
 static double sinc(double x) { return (x == 0.0 ? 1.0 : sin(_PI_ * x) / (_PI_ * x)); }
 static double windowed_sinc(double x) { return blackman(0.5 + 0.5 * x / (LW / 2)) * sinc(x); }
 
-/* f_inp: input frequency. f_out: output frequencey, ch: number of channels */
-OPL_RateConv *OPL_RateConv_new(double f_inp, double f_out, int ch) {
-  OPL_RateConv *conv = malloc(sizeof(OPL_RateConv));
+/* create sinc_table for positive 0 <= x < LW/2 */
+static void make_sinc_table(OPL_RateConv *conv) {
   int i;
-
-  conv->ch = ch;
-  conv->f_ratio = f_inp / f_out;
-  conv->buf = malloc(sizeof(void *) * ch);
-  for (i = 0; i < ch; i++) {
-    conv->buf[i] = malloc(sizeof(conv->buf[0][0]) * LW);
-  }
-
-  /* create sinc_table for positive 0 <= x < LW/2 */
-  conv->sinc_table = malloc(sizeof(conv->sinc_table[0]) * SINC_RESO * LW / 2);
   for (i = 0; i < SINC_RESO * LW / 2; i++) {
     const double x = (double)i / SINC_RESO;
-    if (f_out < f_inp) {
+    if (conv->f_ratio > 1) {
       /* for downsampling */
       conv->sinc_table[i] = (int16_t)((1 << SINC_AMP_BITS) * windowed_sinc(x / conv->f_ratio) / conv->f_ratio);
     } else {
@@ -206,10 +222,37 @@ OPL_RateConv *OPL_RateConv_new(double f_inp, double f_out, int ch) {
       conv->sinc_table[i] = (int16_t)((1 << SINC_AMP_BITS) * windowed_sinc(x));
     }
   }
+}
+
+/* f_inp: input frequency. f_out: output frequencey, ch: number of channels */
+OPL_RateConv *OPL_RateConv_new(double f_inp, double f_out, int ch) {
+  OPL_RateConv *conv = (OPL_RateConv *)malloc(sizeof(OPL_RateConv));
+  int i;
+
+  conv->ch = ch;
+  conv->f_ratio = f_inp / f_out;
+  conv->buf = (int16_t **)malloc(sizeof(void *) * ch);
+  for (i = 0; i < ch; i++) {
+    conv->buf[i] = (int16_t *)malloc(sizeof(conv->buf[0][0]) * LW);
+  }
+
+  conv->sinc_table = (int16_t *)malloc(sizeof(conv->sinc_table[0]) * SINC_RESO * LW / 2);
+  make_sinc_table(conv);
 
   return conv;
 }
 
+/* change the conversion ratio, keeping the buffered input. The sinc table only depends on the ratio when
+ * downsampling, so it is rebuilt (in place) only then. */
+void OPL_RateConv_setRatio(OPL_RateConv *conv, double f_inp, double f_out) {
+  const double f_ratio = f_inp / f_out;
+  const int rebuild = f_ratio != conv->f_ratio && (f_ratio > 1 || conv->f_ratio > 1);
+  conv->f_ratio = f_ratio;
+  if (rebuild) {
+    make_sinc_table(conv);
+  }
+}
+
 static INLINE int16_t lookup_sinc_table(int16_t *table, double x) {
   int16_t index = (int16_t)(x * SINC_RESO);
   if (index < 0)
@@ -250,7 +293,9 @@ int16_t OPL_RateConv_getData(OPL_RateConv *conv, int ch) {
     double x = ((double)k - (LW / 2 - 1)) - dn;
     sum += buf[k] * lookup_sinc_table(conv->sinc_table, x);
   }
-  return sum >> SINC_AMP_BITS;
+  /* the sinc overshoots around full-scale steps */
+  sum >>= SINC_AMP_BITS;
+  return sum < -32768 ? -32768 : (32767 < sum ? 32767 : sum);
 }
 
 void OPL_RateConv_delete(OPL_RateConv *conv) {
@@ -268,8 +313,8 @@ void OPL_RateConv_delete(OPL_RateConv *conv) {
                   Create tables
 
 ****************************************************/
-static void makeSinTable(void) {
-  int x;
+TABLE_FUNC void makeSinTable(uint16_t wave_table_map[8][PG_WIDTH]) {
+  int x = 0;
 
   for (x = 0; x < PG_WIDTH; x++) {
     if (x < PG_WIDTH / 4) {
@@ -308,12 +353,28 @@ static void makeSinTable(void) {
       wave_table_map[3][x] = 0xfff;
     }
   }
+
+  /* YMF262 waveforms, after the phase decoding of Nuked OPL3 */
+  for (x = 0; x < PG_WIDTH; x++) {
+    const uint16_t h = (x & 0x80) ? logsin_table[((x ^ 0xff) << 1) & 0xff] : logsin_table[(x << 1) & 0xff];
+    if (x & 0x200) {
+      wave_table_map[4][x] = 0xfff;
+      wave_table_map[5][x] = 0xfff;
+      wave_table_map[6][x] = 0x8000;
+      wave_table_map[7][x] = 0x8000 | (((x & 0x1ff) ^ 0x1ff) << 3);
+    } else {
+      wave_table_map[4][x] = ((x & 0x300) == 0x100 ? 0x8000 : 0) | h;
+      wave_table_map[5][x] = h;
+      wave_table_map[6][x] = 0;
+      wave_table_map[7][x] = x << 3;
+    }
+  }
 }
 
-static void makeTllTable(void) {
+TABLE_FUNC void makeTllTable(uint32_t tll_table[8 * 16][1 << TL_BITS][4]) {
 
-  int32_t tmp;
-  int32_t fnum, block, TL, KL, kx;
+  int32_t tmp = 0;
+  int32_t fnum = 0, block = 0, TL = 0, KL = 0, kx = 0;
 
   for (fnum = 0; fnum < 16; fnum++) {
     for (block = 0; block < 8; block++) {
@@ -335,9 +396,9 @@ static void makeTllTable(void) {
   }
 }
 
-static void makeRksTable(void) {
-  int fnum8, fnum9, blk;
-  int blk_fnum98;
+TABLE_FUNC void makeRksTable(int32_t rks_table[2][32][2]) {
+  int fnum8 = 0, fnum9 = 0, blk = 0;
+  int blk_fnum98 = 0;
   for (fnum8 = 0; fnum8 < 2; fnum8++)
     for (fnum9 = 0; fnum9 < 2; fnum9++)
       for (blk = 0; blk < 8; blk++) {
@@ -349,15 +410,46 @@ static void makeRksTable(void) {
       }
 }
 
-static uint8_t table_initialized = 0;
+#ifdef __cplusplus
+struct OPL_TABLES {
+  uint16_t wave_table_map[8][PG_WIDTH];
+  uint32_t tll_table[8 * 16][1 << TL_BITS][4];
+  int32_t rks_table[2][32][2];
+};
 
-static void initializeTables() {
-  makeTllTable();
-  makeRksTable();
-  makeSinTable();
-  table_initialized = 1;
+static constexpr OPL_TABLES makeTables() {
+  OPL_TABLES t = {};
+  makeTllTable(t.tll_table);
+  makeRksTable(t.rks_table);
+  makeSinTable(t.wave_table_map);
+  return t;
 }
 
+static constexpr OPL_TABLES tables = makeTables();
+static constexpr const uint16_t (&wave_table_map)[8][PG_WIDTH] = tables.wave_table_map;
+static constexpr const uint32_t (&tll_table)[8 * 16][1 << TL_BITS][4] = tables.tll_table;
+static constexpr const int32_t (&rks_table)[2][32][2] = tables.rks_table;
+#else
+static void initializeTables(void) {
+  makeTllTable(tll_table);
+  makeRksTable(rks_table);
+  makeSinTable(wave_table_map);
+}
+
+/* tables are built once, even if the first instances are created on several threads at a time */
+#if defined(_WIN32)
+static INIT_ONCE table_once = INIT_ONCE_STATIC_INIT;
+static BOOL CALLBACK initializeTablesOnce(PINIT_ONCE once, PVOID param, PVOID *context) {
+  initializeTables();
+  return TRUE;
+}
+#define INITIALIZE_TABLES() InitOnceExecuteOnce(&table_once, initializeTablesOnce, NULL, NULL)
+#else
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+#define INITIALIZE_TABLES() pthread_once(&table_once, initializeTables)
+#endif
+#endif
+
 /*********************************************************
 
                       Synthesizing
@@ -409,64 +501,73 @@ static INLINE void _debug_print_slot_info(OPL_SLOT *slot) {
 #endif
 
 static INLINE int get_parameter_rate(OPL_SLOT *slot) {
-  switch (slot->eg_state) {
-  case ATTACK:
-    return slot->patch->AR;
-  case DECAY:
-    return slot->patch->DR;
-  case SUSTAIN:
-    return slot->patch->EG ? 0 : slot->patch->RR;
-  case RELEASE:
-    return slot->patch->RR;
-  default:
-    return 0;
-  }
+  const int rate[4] = {slot->patch->AR, slot->patch->DR, slot->patch->RR & (slot->patch->EG - 1), slot->patch->RR};
+  return rate[slot->eg_state & 3];
 }
 
+/* each flag refreshes the derived values of one group of inputs:
+ * WS: wave table, TLL: TL/KL and fnum >> 6, RKS: KR, NOTESEL and fnum >> 8 (rks, then the eg rate),
+ * EG: eg state and AR/DR/RR/EG (eg rate), PG: ML, fnum and block (phase increment) */
 enum SLOT_UPDATE_FLAG {
   UPDATE_WS = 1,
   UPDATE_TLL = 2,
   UPDATE_RKS = 4,
   UPDATE_EG = 8,
+  UPDATE_PG = 16,
   UPDATE_ALL = 255,
 };
 
 static INLINE void request_update(OPL_SLOT *slot, int flag) { slot->update_requests |= flag; }
 
+/* flags for the derived values that depend on the fields changed from p to n; 0 for a redundant write */
+static INLINE int patch_update_flags(const OPL_PATCH *p, const OPL_PATCH *n) {
+  int flag = 0;
+  if (p->WS != n->WS)
+    flag |= UPDATE_WS;
+  if (p->TL != n->TL || p->KL != n->KL)
+    flag |= UPDATE_TLL;
+  if (p->KR != n->KR)
+    flag |= UPDATE_RKS;
+  if (p->EG != n->EG || p->AR != n->AR || p->DR != n->DR || p->RR != n->RR)
+    flag |= UPDATE_EG;
+  if (p->ML != n->ML)
+    flag |= UPDATE_PG;
+  return flag;
+}
+
+/* writes a slot patch, requesting only the updates that the changed fields need */
+static INLINE void set_patch(OPL_SLOT *slot, const OPL_PATCH *n) {
+  request_update(slot, patch_update_flags(slot->patch, n));
+  *slot->patch = *n;
+}
+
 static void commit_slot_update(OPL_SLOT *slot, uint8_t notesel) {
+  const uint8_t flag = slot->update_requests;
 
-  if (slot->update_requests & UPDATE_WS) {
-    slot->wave_table = wave_table_map[slot->patch->WS & 3];
+  if (flag & UPDATE_WS) {
+    slot->wave_table = wave_table_map[slot->patch->WS & 7];
   }
 
-  if (slot->update_requests & UPDATE_TLL) {
-    if ((slot->type & 1) == 0) {
-      slot->tll = tll_table[slot->blk_fnum >> 6][slot->patch->TL][slot->patch->KL];
-    } else {
-      slot->tll = tll_table[slot->blk_fnum >> 6][slot->patch->TL][slot->patch->KL];
-    }
+  if (flag & UPDATE_TLL) {
+    slot->tll = tll_table[slot->blk_fnum >> 6][slot->patch->TL][slot->patch->KL];
   }
 
-  if (slot->update_requests & UPDATE_RKS) {
+  if (flag & UPDATE_RKS) {
     slot->rks = rks_table[notesel][slot->blk_fnum >> 8][slot->patch->KR];
   }
 
-  if (slot->update_requests & (UPDATE_RKS | UPDATE_EG)) {
-    int p_rate = get_parameter_rate(slot);
+  if (flag & (UPDATE_RKS | UPDATE_EG)) {
+    /* a zero parameter rate stops the envelope regardless of rks */
+    const int p_rate = get_parameter_rate(slot);
+    const int on = -(p_rate != 0);
+    slot->eg_rate_h = min(15, p_rate + (slot->rks >> 2)) & on;
+    slot->eg_rate_l = slot->rks & 3 & on;
+    slot->eg_shift = eg_shift_table[slot->eg_rate_h];
+  }
 
-    if (p_rate == 0) {
-      slot->eg_shift = 0;
-      slot->eg_rate_h = 0;
-      slot->eg_rate_l = 0;
-    } else {
-      slot->eg_rate_h = min(15, p_rate + (slot->rks >> 2));
-      slot->eg_rate_l = slot->rks & 3;
-      if (slot->eg_state == ATTACK) {
-        slot->eg_shift = (0 < slot->eg_rate_h && slot->eg_rate_h < 12) ? (12 - slot->eg_rate_h) : 0;
-      } else {
-        slot->eg_shift = (slot->eg_rate_h < 12) ? (12 - slot->eg_rate_h) : 0;
-      }
-    }
+  if (flag & UPDATE_PG) {
+    slot->pg_mul = ml_table[slot->patch->ML] << slot->blk;
+    slot->pg_inc = slot->fnum * slot->pg_mul;
   }
 
 #if OPL_DEBUG
@@ -496,13 +597,16 @@ static void reset_slot(OPL_SLOT *slot, int number) {
   slot->blk_fnum = 0;
   slot->blk = 0;
   slot->fnum = 0;
+  slot->pg_inc = 0;
+  slot->pg_mul = 0;
   slot->pg_out = 0;
   slot->eg_out = EG_MUTE;
+  slot->update_requests = UPDATE_ALL;
 }
 
 static INLINE void slotOn(OPL *opl, int i) {
   OPL_SLOT *slot = &opl->slot[i];
-  slot->rks = rks_table[opl->notesel][slot->blk_fnum >> 8][slot->patch->KR];
+  slot->rks = rks_table[opl->notesel[i >= 18]][slot->blk_fnum >> 8][slot->patch->KR];
   if (min(15, slot->patch->AR + (slot->rks >> 2)) == 15) {
     slot->eg_state = DECAY;
     slot->eg_out = 0;
@@ -521,113 +625,194 @@ static INLINE void slotOff(OPL *opl, int i) {
   request_update(slot, UPDATE_EG);
 }
 
-static INLINE void update_key_status(OPL *opl) {
-  const uint8_t r14 = opl->reg[0xbd];
-  const uint8_t rhythm_mode = BIT(r14, 5);
-  uint32_t new_slot_key_status = 0;
-  uint32_t updated_status;
-  int ch;
-
-  if (opl->csm_mode && opl->csm_key_count) {
-    new_slot_key_status = 0x3ffff;
-  }
-
-  for (ch = 0; ch < 9; ch++)
-    if (opl->reg[0xB0 + ch] & 0x20)
-      new_slot_key_status |= 3 << (ch * 2);
+/* key-on bits of the rhythm slots for $BD */
+static INLINE uint32_t rhythm_key_status(uint8_t r14) {
+  uint32_t status = 0;
 
-  if (rhythm_mode) {
+  if (BIT(r14, 5)) {
     if (r14 & 0x10)
-      new_slot_key_status |= 3 << SLOT_BD1;
+      status |= 3 << SLOT_BD1;
 
     if (r14 & 0x01)
-      new_slot_key_status |= 1 << SLOT_HH;
+      status |= 1 << SLOT_HH;
 
     if (r14 & 0x08)
-      new_slot_key_status |= 1 << SLOT_SD;
+      status |= 1 << SLOT_SD;
 
     if (r14 & 0x04)
-      new_slot_key_status |= 1 << SLOT_TOM;
+      status |= 1 << SLOT_TOM;
 
     if (r14 & 0x02)
-      new_slot_key_status |= 1 << SLOT_CYM;
+      status |= 1 << SLOT_CYM;
   }
 
-  updated_status = opl->slot_key_status ^ new_slot_key_status;
+  return status;
+}
 
-  if (updated_status) {
-    int i;
-    for (i = 0; i < 18; i++)
-      if (BIT(updated_status, i)) {
-        if (BIT(new_slot_key_status, i)) {
-          slotOn(opl, i);
-        } else {
-          slotOff(opl, i);
-        }
-      }
+static INLINE int lowest_bit(uint64_t x) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(x);
+#else
+  int i = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    i++;
   }
+  return i;
+#endif
+}
+
+/* key on/off only the slots whose status differs from the key sources */
+static INLINE void update_key_status(OPL *opl) {
+  uint64_t new_slot_key_status = opl->key_status_ch | opl->key_status_rhythm;
+  uint64_t updated_status;
 
+  if (opl->csm_mode && opl->csm_key_count) {
+    new_slot_key_status |= 0x3ffff;
+  }
+
+  updated_status = opl->slot_key_status ^ new_slot_key_status;
   opl->slot_key_status = new_slot_key_status;
+
+  while (updated_status) {
+    const int i = lowest_bit(updated_status);
+    updated_status &= updated_status - 1;
+    if (BIT(new_slot_key_status, i)) {
+      slotOn(opl, i);
+    } else {
+      slotOff(opl, i);
+    }
+  }
+}
+
+/* $B0 key bit of channel ch; the second channel of a 4-operator pair is keyed by the first */
+static INLINE void set_channel_key(OPL *opl, int ch, uint8_t key) {
+  uint64_t bits;
+  if (BIT(opl->four_op << 3, ch))
+    return;
+  bits = (uint64_t)3 << (ch * 2);
+  if (BIT(opl->four_op, ch)) {
+    bits |= bits << 6;
+  }
+  if (key) {
+    opl->key_status_ch |= bits;
+  } else {
+    opl->key_status_ch &= ~bits;
+  }
+}
+
+static void rebuild_channel_keys(OPL *opl) {
+  int ch;
+  opl->key_status_ch = 0;
+  for (ch = 0; ch < 9; ch++)
+    set_channel_key(opl, ch, opl->reg[0xB0 + ch] & 0x20);
+  if (opl->slot_count > 18) {
+    for (ch = 9; ch < 18; ch++)
+      set_channel_key(opl, ch, opl->reg[0x1A7 + ch] & 0x20);
+  }
+}
+
+static void update_rhythm_keys(OPL *opl) {
+  opl->key_status_rhythm = rhythm_key_status(opl->reg[0xbd]);
+  if (opl->dual) {
+    opl->key_status_rhythm |= (uint64_t)rhythm_key_status(opl->reg[0x1bd]) << 18;
+  }
 }
 
 /* set f-Nnmber ( fnum : 10bit ) */
 static INLINE void set_fnumber(OPL *opl, int ch, int fnum) {
   OPL_SLOT *car = CAR(opl, ch);
   OPL_SLOT *mod = MOD(opl, ch);
+  /* the level uses fnum >> 6 and rks fnum >> 8; the low bits only change the phase increment */
+  const int diff = car->fnum ^ fnum;
+  const int flag = UPDATE_PG | (diff >> 6 ? UPDATE_TLL : 0) | (diff >> 8 ? UPDATE_RKS : 0);
+  if (diff == 0)
+    return;
   car->fnum = fnum;
   car->blk_fnum = (car->blk_fnum & 0x1c00) | (fnum & 0x3ff);
   mod->fnum = fnum;
   mod->blk_fnum = (mod->blk_fnum & 0x1c00) | (fnum & 0x3ff);
-  request_update(car, UPDATE_EG | UPDATE_RKS | UPDATE_TLL);
-  request_update(mod, UPDATE_EG | UPDATE_RKS | UPDATE_TLL);
+  request_update(car, flag);
+  request_update(mod, flag);
 }
 
 /* set block data (blk : 3bit ) */
 static INLINE void set_block(OPL *opl, int ch, int blk) {
   OPL_SLOT *car = CAR(opl, ch);
   OPL_SLOT *mod = MOD(opl, ch);
+  if (car->blk == blk)
+    return;
   car->blk = blk;
   car->blk_fnum = ((blk & 7) << 10) | (car->blk_fnum & 0x3ff);
   mod->blk = blk;
   mod->blk_fnum = ((blk & 7) << 10) | (mod->blk_fnum & 0x3ff);
-  request_update(car, UPDATE_EG | UPDATE_RKS | UPDATE_TLL);
-  request_update(mod, UPDATE_EG | UPDATE_RKS | UPDATE_TLL);
+  request_update(car, UPDATE_PG | UPDATE_RKS | UPDATE_TLL);
+  request_update(mod, UPDATE_PG | UPDATE_RKS | UPDATE_TLL);
 }
 
-static INLINE void update_rhythm_mode(OPL *opl) {
-  const uint8_t new_rhythm_mode = (opl->reg[0xbd] >> 5) & 1;
+/* b: 0, or 1 for the second chip of dual mode */
+static INLINE void update_rhythm_mode(OPL *opl, int b) {
+  const uint8_t new_rhythm_mode = (opl->reg[(b << 8) | 0xbd] >> 5) & 1;
+  OPL_SLOT *slot = &opl->slot[b * 18];
 
-  if (opl->rhythm_mode != new_rhythm_mode) {
+  if (opl->rhythm_mode[b] != new_rhythm_mode) {
     if (new_rhythm_mode) {
-      opl->slot[SLOT_HH].type = 3;
-      opl->slot[SLOT_HH].pg_keep = 1;
-      opl->slot[SLOT_SD].type = 3;
-      opl->slot[SLOT_TOM].type = 3;
-      opl->slot[SLOT_CYM].type = 3;
-      opl->slot[SLOT_CYM].pg_keep = 1;
+      slot[SLOT_HH].type = 3;
+      slot[SLOT_HH].pg_keep = 1;
+      slot[SLOT_SD].type = 3;
+      slot[SLOT_TOM].type = 3;
+      slot[SLOT_CYM].type = 3;
+      slot[SLOT_CYM].pg_keep = 1;
     } else {
-      opl->slot[SLOT_HH].type = 0;
-      opl->slot[SLOT_HH].pg_keep = 0;
-      opl->slot[SLOT_SD].type = 1;
-      opl->slot[SLOT_TOM].type = 0;
-      opl->slot[SLOT_CYM].type = 1;
-      opl->slot[SLOT_CYM].pg_keep = 0;
+      slot[SLOT_HH].type = 0;
+      slot[SLOT_HH].pg_keep = 0;
+      slot[SLOT_SD].type = 1;
+      slot[SLOT_TOM].type = 0;
+      slot[SLOT_CYM].type = 1;
+      slot[SLOT_CYM].pg_keep = 0;
+    }
+  }
+  opl->rhythm_mode[b] = new_rhythm_mode;
+}
+
+/* LFO outputs only change every 64 (AM) or 1024 (PM) ticks; they are refreshed from here on a step change */
+static void update_lfo_am(OPL *opl) {
+  const uint8_t level = am_table[opl->am_phase >> 6];
+  opl->lfo_am[0] = level >> (opl->am_mode[0] ? 0 : 2);
+  opl->lfo_am[1] = level >> (opl->am_mode[1] ? 0 : 2);
+}
+
+static void update_lfo_pm(OPL *opl) {
+  const uint32_t step = PM_STEP(opl->pm_phase);
+  int b, i;
+  for (b = 0; b < 2; b++) {
+    for (i = 0; i < 8; i++) {
+      opl->lfo_pm[b][i] = pm_table[i][step] >> (opl->pm_mode[b] ? 0 : 1);
     }
   }
-  opl->rhythm_mode = new_rhythm_mode;
 }
 
 static void update_ampm(OPL *opl) {
-  const uint32_t pm_inc = (opl->test_flag & 8) ? opl->pm_dphase << 10 : opl->pm_dphase;
-  const uint32_t am_inc = (opl->test_flag & 8) ? 64 : 1;
-  if (opl->test_flag & 2) {
+  const uint32_t pm_inc = (opl->test_flag[0] & 8) ? opl->pm_dphase << 10 : opl->pm_dphase;
+  const uint32_t am_inc = (opl->test_flag[0] & 8) ? 64 : 1;
+  const uint32_t am_step = opl->am_phase >> 6;
+  const uint32_t pm_step = PM_STEP(opl->pm_phase);
+  if (opl->test_flag[0] & 2) {
     opl->pm_phase = 0;
     opl->am_phase = 0;
   } else {
     opl->pm_phase = (opl->pm_phase + pm_inc) & (PM_DP_WIDTH - 1);
     opl->am_phase += am_inc;
+    if (opl->am_phase >= AM_DP_WIDTH) {
+      opl->am_phase -= AM_DP_WIDTH;
+    }
+  }
+  if ((opl->am_phase >> 6) != am_step) {
+    update_lfo_am(opl);
+  }
+  if (PM_STEP(opl->pm_phase) != pm_step) {
+    update_lfo_pm(opl);
   }
-  opl->lfo_am = am_table[(opl->am_phase >> 6) % sizeof(am_table)] >> (opl->am_mode ? 0 : 2);
 }
 
 static void update_noise(OPL *opl, int cycle) {
@@ -640,9 +825,9 @@ static void update_noise(OPL *opl, int cycle) {
   }
 }
 
-static void update_short_noise(OPL *opl) {
-  const uint32_t pg_hh = opl->slot[SLOT_HH].pg_out;
-  const uint32_t pg_cym = opl->slot[SLOT_CYM].pg_out;
+static INLINE void update_short_noise(OPL *opl, int b) {
+  const uint32_t pg_hh = opl->slot[b * 18 + SLOT_HH].pg_out;
+  const uint32_t pg_cym = opl->slot[b * 18 + SLOT_CYM].pg_out;
 
   const uint8_t h_bit2 = BIT(pg_hh, PG_BITS - 8);
   const uint8_t h_bit7 = BIT(pg_hh, PG_BITS - 3);
@@ -651,20 +836,16 @@ static void update_short_noise(OPL *opl) {
   const uint8_t c_bit3 = BIT(pg_cym, PG_BITS - 7);
   const uint8_t c_bit5 = BIT(pg_cym, PG_BITS - 5);
 
-  opl->short_noise = (h_bit2 ^ h_bit7) | (h_bit3 ^ c_bit5) | (c_bit3 ^ c_bit5);
+  opl->short_noise[b] = (h_bit2 ^ h_bit7) | (h_bit3 ^ c_bit5) | (c_bit3 ^ c_bit5);
 }
 
-static INLINE void calc_phase(OPL_SLOT *slot, int32_t pm_phase, uint8_t pm_mode, uint8_t reset) {
-  int8_t pm = 0;
-  if (slot->patch->PM) {
-    pm = pm_table[(slot->fnum >> 7) & 7][pm_phase >> (PM_DP_BITS - PM_PG_BITS)];
-    pm >>= (pm_mode ? 0 : 1);
-  }
+static INLINE void calc_phase(OPL_SLOT *slot, const int8_t *lfo_pm, uint8_t reset) {
+  const int pm = slot->patch->PM ? lfo_pm[(slot->fnum >> 7) & 7] : 0;
 
   if (reset) {
     slot->pg_phase = 0;
   }
-  slot->pg_phase += (((slot->fnum & 0x3ff) + pm) * ml_table[slot->patch->ML]) << slot->blk >> 1;
+  slot->pg_phase += (slot->pg_inc + pm * slot->pg_mul) >> 1;
   slot->pg_phase &= (DP_WIDTH - 1);
   slot->pg_out = slot->pg_phase >> DP_BASE_BITS;
 }
@@ -742,17 +923,24 @@ static INLINE void calc_envelope(OPL_SLOT *slot, uint16_t eg_counter, uint8_t te
   }
 }
 
-static void update_slots(OPL *opl) {
+/* b: slots 0..17, or 18..35 */
+static INLINE void update_slot_bank(OPL *opl, int b) {
   int i;
-  opl->eg_counter++;
-
-  for (i = 0; i < 18; i++) {
+  for (i = b * 18; i < b * 18 + 18; i++) {
     OPL_SLOT *slot = &opl->slot[i];
     if (slot->update_requests) {
-      commit_slot_update(slot, opl->notesel);
+      commit_slot_update(slot, opl->notesel[b]);
     }
-    calc_envelope(slot, opl->eg_counter, opl->test_flag & 1);
-    calc_phase(slot, opl->pm_phase, opl->pm_mode, opl->test_flag & 4);
+    calc_envelope(slot, opl->eg_counter, opl->test_flag[b] & 1);
+    calc_phase(slot, opl->lfo_pm[b], opl->test_flag[b] & 4);
+  }
+}
+
+static void update_slots(OPL *opl) {
+  opl->eg_counter++;
+  update_slot_bank(opl, 0);
+  if (opl->slot_count > 18) {
+    update_slot_bank(opl, 1);
   }
 }
 
@@ -773,10 +961,8 @@ static INLINE int16_t to_linear(uint16_t h, OPL_SLOT *slot, int16_t am) {
   return lookup_exp_table(h + att);
 }
 
-static INLINE int16_t calc_slot_car(OPL *opl, int ch, int16_t fm) {
-  OPL_SLOT *slot = CAR(opl, ch);
-
-  uint8_t am = slot->patch->AM ? opl->lfo_am : 0;
+static INLINE int16_t calc_slot_fm(OPL *opl, OPL_SLOT *slot, int16_t fm) {
+  uint8_t am = slot->patch->AM ? opl->lfo_am[slot->number >= 18] : 0;
 
   slot->output[1] = slot->output[0];
   slot->output[0] = to_linear(slot->wave_table[(slot->pg_out + 2 * (fm >> 1)) & (PG_WIDTH - 1)], slot, am);
@@ -784,11 +970,13 @@ static INLINE int16_t calc_slot_car(OPL *opl, int ch, int16_t fm) {
   return slot->output[0];
 }
 
+static INLINE int16_t calc_slot_car(OPL *opl, int ch, int16_t fm) { return calc_slot_fm(opl, CAR(opl, ch), fm); }
+
 static INLINE int16_t calc_slot_mod(OPL *opl, int ch) {
   OPL_SLOT *slot = MOD(opl, ch);
 
   int16_t fm = slot->patch->FB > 0 ? (slot->output[1] + slot->output[0]) >> (9 - slot->patch->FB) : 0;
-  uint8_t am = slot->patch->AM ? opl->lfo_am : 0;
+  uint8_t am = slot->patch->AM ? opl->lfo_am[ch >= 9] : 0;
 
   slot->output[1] = slot->output[0];
   slot->output[0] = to_linear(slot->wave_table[(slot->pg_out + fm) & (PG_WIDTH - 1)], slot, am);
@@ -796,8 +984,9 @@ static INLINE int16_t calc_slot_mod(OPL *opl, int ch) {
   return slot->output[0];
 }
 
-static INLINE int16_t calc_slot_tom(OPL *opl) {
-  OPL_SLOT *slot = &(opl->slot[SLOT_TOM]);
+/* rhythm slots of the chip b (0, or 1 for the second chip of dual mode) */
+static INLINE int16_t calc_slot_tom(OPL *opl, int b) {
+  OPL_SLOT *slot = &(opl->slot[b * 18 + SLOT_TOM]);
 
   return to_linear(slot->wave_table[slot->pg_out], slot, 0);
 }
@@ -805,12 +994,12 @@ static INLINE int16_t calc_slot_tom(OPL *opl) {
 /* Specify phase offset directly based on 10-bit (1024-length) sine table */
 #define _PD(phase) ((PG_BITS < 10) ? (phase >> (10 - PG_BITS)) : (phase << (PG_BITS - 10)))
 
-static INLINE int16_t calc_slot_snare(OPL *opl) {
-  OPL_SLOT *slot = &(opl->slot[SLOT_SD]);
+static INLINE int16_t calc_slot_snare(OPL *opl, int b) {
+  OPL_SLOT *slot = &(opl->slot[b * 18 + SLOT_SD]);
 
   uint32_t phase;
 
-  if (BIT(opl->slot[SLOT_HH].pg_out, PG_BITS - 2))
+  if (BIT(opl->slot[b * 18 + SLOT_HH].pg_out, PG_BITS - 2))
     phase = (opl->noise & 1) ? _PD(0x300) : _PD(0x200);
   else
     phase = (opl->noise & 1) ? _PD(0x0) : _PD(0x100);
@@ -818,20 +1007,20 @@ static INLINE int16_t calc_slot_snare(OPL *opl) {
   return to_linear(slot->wave_table[phase], slot, 0);
 }
 
-static INLINE int16_t calc_slot_cym(OPL *opl) {
-  OPL_SLOT *slot = &(opl->slot[SLOT_CYM]);
+static INLINE int16_t calc_slot_cym(OPL *opl, int b) {
+  OPL_SLOT *slot = &(opl->slot[b * 18 + SLOT_CYM]);
 
-  uint32_t phase = opl->short_noise ? _PD(0x300) : _PD(0x100);
+  uint32_t phase = opl->short_noise[b] ? _PD(0x300) : _PD(0x100);
 
   return to_linear(slot->wave_table[phase], slot, 0);
 }
 
-static INLINE int16_t calc_slot_hat(OPL *opl) {
-  OPL_SLOT *slot = &(opl->slot[SLOT_HH]);
+static INLINE int16_t calc_slot_hat(OPL *opl, int b) {
+  OPL_SLOT *slot = &(opl->slot[b * 18 + SLOT_HH]);
 
   uint32_t phase;
 
-  if (opl->short_noise)
+  if (opl->short_noise[b])
     phase = (opl->noise & 1) ? _PD(0x2d0) : _PD(0x234);
   else
     phase = (opl->noise & 1) ? _PD(0x34) : _PD(0xd0);
@@ -849,9 +1038,86 @@ static INLINE int16_t calc_fm(OPL *opl, int ch) {
   return calc_slot_car(opl, ch, calc_slot_mod(opl, ch));
 }
 
-static void latch_timer1(OPL *opl) { opl->timer1_counter = opl->reg[0x02] << 2; }
+/* YMF262 4-operator channel: slots of ch, then slots of ch + 3. connection is (CNT of ch, CNT of ch + 3). */
+static INLINE int16_t calc_fm4(OPL *opl, int ch) {
+  const int16_t m = calc_slot_mod(opl, ch);
+  switch ((opl->ch_alg[ch] << 1) | opl->ch_alg[ch + 3]) {
+  case 0:
+    return calc_slot_car(opl, ch + 3, calc_slot_fm(opl, MOD(opl, ch + 3), calc_slot_car(opl, ch, m)));
+  case 1:
+    return calc_slot_car(opl, ch, m) + calc_slot_car(opl, ch + 3, calc_slot_fm(opl, MOD(opl, ch + 3), 0));
+  case 2:
+    return m + calc_slot_car(opl, ch + 3, calc_slot_fm(opl, MOD(opl, ch + 3), calc_slot_car(opl, ch, 0)));
+  default:
+    return m + calc_slot_fm(opl, MOD(opl, ch + 3), calc_slot_car(opl, ch, 0)) + calc_slot_car(opl, ch + 3, 0);
+  }
+}
+
+/* YMF262 channels base..base + 5, where ch and ch + 3 (ch < base + 3) may form a 4-operator channel */
+static INLINE void calc_tone_group(OPL *opl, int base) {
+  int16_t *out = opl->ch_out;
+  int ch;
+  for (ch = base; ch < base + 3; ch++) {
+    if (BIT(opl->four_op, ch)) {
+      out[OPL_OUT_CH(ch)] = 0;
+      if (!(opl->mask & OPL_MASK_CH(ch + 3))) {
+        out[OPL_OUT_CH(ch + 3)] = _MO(calc_fm4(opl, ch));
+      }
+    } else {
+      if (!(opl->mask & OPL_MASK_CH(ch))) {
+        out[OPL_OUT_CH(ch)] = _MO(calc_fm(opl, ch));
+      }
+      if (!(opl->mask & OPL_MASK_CH(ch + 3))) {
+        out[OPL_OUT_CH(ch + 3)] = _MO(calc_fm(opl, ch + 3));
+      }
+    }
+  }
+}
+
+/* cache the ADPCM output while it is known to be constant. */
+static void refresh_adpcm_idle(OPL *opl) {
+  opl->adpcm_idle = opl->adpcm ? OPL_ADPCM_getConstantOutput(opl->adpcm, &opl->adpcm_idle_out) : 0;
+}
+
+/* record an event for the current block render call. */
+static void push_event(OPL *opl, uint8_t type) {
+  if (opl->event_count < opl->event_max) {
+    opl->events[opl->event_count].offset = opl->block_sample;
+    opl->events[opl->event_count].type = type;
+    opl->event_count++;
+  } else {
+    opl->event_dropped++;
+  }
+}
+
+/* Report a transition of the IRQ line. in_tick is 1 when called while processing a tick (opl->tick already
+ * advanced for it), so that the offset passed to the callback counts internal ticks from 0. */
+static void update_irq(OPL *opl, int in_tick) {
+  uint8_t irq;
+
+  if (opl->irq_func == NULL && opl->events == NULL)
+    return;
+
+  irq = OPL_status(opl) >> 7;
+  if (irq != opl->irq_line) {
+    opl->irq_line = irq;
+    if (opl->events) {
+      push_event(opl, irq ? OPL_EVENT_IRQ_ON : OPL_EVENT_IRQ_OFF);
+    } else {
+      opl->irq_func(opl->irq_user_data, irq, opl->tick - opl->block_tick - in_tick);
+    }
+  }
+}
+
+static void latch_timer1(OPL *opl) {
+  opl->timer1_start = opl->tick;
+  opl->timer1_period = 1024 - (opl->reg[0x02] << 2);
+}
 
-static void latch_timer2(OPL *opl) { opl->timer2_counter = opl->reg[0x03] << 4; }
+static void latch_timer2(OPL *opl) {
+  opl->timer2_start = opl->tick;
+  opl->timer2_period = 4096 - (opl->reg[0x03] << 4);
+}
 
 static void csm_key_on(OPL *opl) {
   opl->csm_key_count = 1;
@@ -863,33 +1129,115 @@ static void csm_key_off(OPL *opl) {
   update_key_status(opl);
 }
 
-static void update_timer(OPL *opl) {
+/* find the nearest tick where the timer unit has something to do. */
+static void schedule_timer(OPL *opl) {
+  uint32_t next = 0xFFFFFFFF;
+
+  if (opl->csm_mode && 0 < opl->csm_key_count) {
+    next = 1;
+  }
+  if (opl->reg[0x04] & 0x01) {
+    next = min(next, opl->timer1_start + opl->timer1_period - opl->tick);
+  }
+  if (opl->reg[0x04] & 0x02) {
+    next = min(next, opl->timer2_start + opl->timer2_period - opl->tick);
+  }
+
+  opl->timer_next = opl->tick + next;
+}
+
+static void process_timer(OPL *opl) {
   if (opl->csm_mode && 0 < opl->csm_key_count) {
     csm_key_off(opl);
   }
 
-  if (opl->reg[0x04] & 0x01) {
-    opl->timer1_counter++;
-    if (opl->timer1_counter >> 10) {
-      opl->status |= 0x40; // timer1 overflow
-      if (opl->csm_mode) {
-        csm_key_on(opl);
-      }
-      if (opl->timer1_func) {
-        opl->timer1_func(opl->timer1_user_data);
+  if ((opl->reg[0x04] & 0x01) && opl->tick - opl->timer1_start >= opl->timer1_period) {
+    opl->status |= 0x40; // timer1 overflow
+    if (opl->events) {
+      push_event(opl, OPL_EVENT_TIMER1);
+    }
+    if (opl->csm_mode) {
+      csm_key_on(opl);
+      if (opl->events) {
+        push_event(opl, OPL_EVENT_CSM_KEY_ON);
       }
-      latch_timer1(opl);
     }
+    if (opl->timer1_func && !opl->events) {
+      opl->timer1_func(opl->timer1_user_data);
+    }
+    latch_timer1(opl);
   }
 
-  if (opl->reg[0x04] & 0x02) {
-    opl->timer2_counter++;
-    if (opl->timer2_counter >> 12) {
-      opl->status |= 0x20; // timer2 overflow
-      if (opl->timer2_func) {
-        opl->timer2_func(opl->timer2_user_data);
-      }
-      latch_timer2(opl);
+  if ((opl->reg[0x04] & 0x02) && opl->tick - opl->timer2_start >= opl->timer2_period) {
+    opl->status |= 0x20; // timer2 overflow
+    if (opl->events) {
+      push_event(opl, OPL_EVENT_TIMER2);
+    } else if (opl->timer2_func) {
+      opl->timer2_func(opl->timer2_user_data);
+    }
+    latch_timer2(opl);
+  }
+
+  update_irq(opl, 1);
+  schedule_timer(opl);
+}
+
+/* timers are kept as (start tick, period); only the scheduled tick needs any work. */
+static INLINE void update_timer(OPL *opl) {
+  opl->tick++;
+  if (opl->tick == opl->timer_next) {
+    process_timer(opl);
+  }
+}
+
+/* CH7-9 of the chip b (0, or 1 for the second chip of dual mode, whose outputs and mask bits are 15 above) */
+static INLINE void calc_ch7(OPL *opl, int b) {
+  int16_t *out = opl->ch_out + b * 15;
+  const uint32_t mask = opl->mask >> (b * 15);
+
+  if (!opl->rhythm_mode[b]) {
+    if (!(mask & OPL_MASK_CH(6))) {
+      out[6] = _MO(calc_fm(opl, b * 9 + 6));
+    }
+  } else {
+    if (!(mask & OPL_MASK_BD)) {
+      out[9] = _RO(calc_fm(opl, b * 9 + 6));
+    }
+  }
+}
+
+static INLINE void calc_ch8(OPL *opl, int b) {
+  int16_t *out = opl->ch_out + b * 15;
+  const uint32_t mask = opl->mask >> (b * 15);
+
+  if (!opl->rhythm_mode[b]) {
+    if (!(mask & OPL_MASK_CH(7))) {
+      out[7] = _MO(calc_fm(opl, b * 9 + 7));
+    }
+  } else {
+    if (!(mask & OPL_MASK_HH)) {
+      out[10] = _RO(calc_slot_hat(opl, b));
+    }
+    if (!(mask & OPL_MASK_SD)) {
+      out[11] = _RO(calc_slot_snare(opl, b));
+    }
+  }
+}
+
+static INLINE void calc_ch9(OPL *opl, int b) {
+  int16_t *out = opl->ch_out + b * 15;
+  const uint32_t mask = opl->mask >> (b * 15);
+
+  if (!opl->rhythm_mode[b]) {
+    if (!(mask & OPL_MASK_CH(8))) {
+      out[8] = _MO(calc_fm(opl, b * 9 + 8));
+    }
+  } else {
+    if (!(mask & OPL_MASK_TOM)) {
+      out[12] = _RO(calc_slot_tom(opl, b));
+    }
+    if (!(mask & OPL_MASK_CYM)) {
+      out[13] = _RO(calc_slot_cym(opl, b));
     }
   }
 }
@@ -900,72 +1248,97 @@ static void update_output(OPL *opl) {
 
   update_timer(opl);
   update_ampm(opl);
-  update_short_noise(opl);
+  update_short_noise(opl, 0);
+  if (opl->dual) {
+    update_short_noise(opl, 1);
+  }
   update_slots(opl);
 
   out = opl->ch_out;
 
   /* CH1-6 */
-  for (i = 0; i < 6; i++) {
-    if (!(opl->mask & OPL_MASK_CH(i))) {
-      out[i] = _MO(calc_fm(opl, i));
-    }
-  }
-
-  /* CH7 */
-  if (!opl->rhythm_mode) {
-    if (!(opl->mask & OPL_MASK_CH(6))) {
-      out[6] = _MO(calc_fm(opl, 6));
-    }
+  if (opl->four_op & 7) {
+    calc_tone_group(opl, 0);
   } else {
-    if (!(opl->mask & OPL_MASK_BD)) {
-      out[9] = _RO(calc_fm(opl, 6));
+    for (i = 0; i < 6; i++) {
+      if (!(opl->mask & OPL_MASK_CH(i))) {
+        out[i] = _MO(calc_fm(opl, i));
+      }
     }
   }
-  update_noise(opl, 14);
 
-  /* CH8 */
-  if (!opl->rhythm_mode) {
-    if (!(opl->mask & OPL_MASK_CH(7))) {
-      out[7] = _MO(calc_fm(opl, 7));
+  if (opl->dual) {
+    /* both chips step together, so that the rhythm of each sees the noise at the same point */
+    for (i = 9; i < 15; i++) {
+      if (!(opl->mask & OPL_MASK_CH(i))) {
+        out[OPL_OUT_CH(i)] = _MO(calc_fm(opl, i));
+      }
     }
+    calc_ch7(opl, 0);
+    calc_ch7(opl, 1);
+    update_noise(opl, 14);
+    calc_ch8(opl, 0);
+    calc_ch8(opl, 1);
+    update_noise(opl, 2);
+    calc_ch9(opl, 0);
+    calc_ch9(opl, 1);
+    update_noise(opl, 2);
   } else {
-    if (!(opl->mask & OPL_MASK_HH)) {
-      out[10] = _RO(calc_slot_hat(opl));
-    }
-    if (!(opl->mask & OPL_MASK_SD)) {
-      out[11] = _RO(calc_slot_snare(opl));
-    }
+    /* CH7 */
+    calc_ch7(opl, 0);
+    update_noise(opl, 14);
+
+    /* CH8 */
+    calc_ch8(opl, 0);
+    update_noise(opl, 2);
+
+    /* CH9 */
+    calc_ch9(opl, 0);
+    update_noise(opl, 2);
   }
-  update_noise(opl, 2);
 
-  /* CH9 */
-  if (!opl->rhythm_mode) {
-    if (!(opl->mask & OPL_MASK_CH(8))) {
-      out[8] = _MO(calc_fm(opl, 8));
-    }
-  } else {
-    if (!(opl->mask & OPL_MASK_TOM)) {
-      out[12] = _RO(calc_slot_tom(opl));
-    }
-    if (!(opl->mask & OPL_MASK_CYM)) {
-      out[13] = _RO(calc_slot_cym(opl));
+  /* YMF262 CH10-18 */
+  if (opl->chip_type == TYPE_YMF262) {
+    calc_tone_group(opl, 9);
+    for (i = 15; i < 18; i++) {
+      if (!(opl->mask & OPL_MASK_CH(i))) {
+        out[OPL_OUT_CH(i)] = _MO(calc_fm(opl, i));
+      }
     }
   }
-  update_noise(opl, 2);
 
   /* ADPCM */
-  if (opl->adpcm != NULL && !(opl->mask & OPL_MASK_ADPCM)) {
-    out[14] = OPL_ADPCM_calc(opl->adpcm);
+  if (opl->adpcm != NULL && !opl->adpcm_native && !(opl->mask & OPL_MASK_ADPCM)) {
+    if (opl->adpcm_idle) {
+      out[14] = opl->adpcm_idle_out;
+    } else {
+      out[14] = OPL_ADPCM_calc(opl->adpcm);
+      if (!opl->adpcm->play_start) {
+        refresh_adpcm_idle(opl);
+        if (opl->events) {
+          push_event(opl, OPL_EVENT_ADPCM_EOS);
+        }
+        update_irq(opl, 1);
+      }
+    }
   }
 }
 
+/* number of channel outputs in use */
+static INLINE int out_count(OPL *opl) { return opl->dual ? OPL_OUT_COUNT : (opl->slot_count > 18 ? 24 : 15); }
+
+static INLINE int16_t saturate16(int32_t v) { return v < -32768 ? -32768 : (32767 < v ? 32767 : v); }
+
 INLINE static void mix_output(OPL *opl) {
-  int16_t out = 0;
+  const int n = out_count(opl);
+  int32_t sum = 0;
+  int16_t out;
   int i;
-  for (i = 0; i < 15; i++) {
-    out += opl->ch_out[i];
+  /* up to OPL_OUT_COUNT full-scale outputs: sum without wrapping and saturate once */
+  for (i = 0; i < n; i++) {
+    sum += opl->ch_out[i];
   }
+  out = saturate16(sum);
   if (opl->conv) {
     OPL_RateConv_putData(opl->conv, 0, out);
   } else {
@@ -973,38 +1346,126 @@ INLINE static void mix_output(OPL *opl) {
   }
 }
 
-INLINE static void mix_output_stereo(OPL *opl) {
-  int16_t *out = opl->mix_out;
+/* panned sum of the channel outputs, not saturated */
+INLINE static void mix_channels_stereo(OPL *opl, int32_t out[2]) {
+  const int n = out_count(opl);
+  int32_t l = 0, r = 0;
   int i;
-  out[0] = out[1] = 0;
-  for (i = 0; i < 15; i++) {
+  for (i = 0; i < n; i++) {
     if (opl->pan[i] & 2)
-      out[0] += (int16_t)(opl->ch_out[i] * opl->pan_fine[i][0]);
+      l += (int16_t)(opl->ch_out[i] * opl->pan_fine[i][0]);
     if (opl->pan[i] & 1)
-      out[1] += (int16_t)(opl->ch_out[i] * opl->pan_fine[i][1]);
+      r += (int16_t)(opl->ch_out[i] * opl->pan_fine[i][1]);
   }
+  out[0] = l;
+  out[1] = r;
+}
+
+INLINE static void mix_output_stereo(OPL *opl) {
+  int16_t *out = opl->mix_out;
+  int32_t mix[2];
+  mix_channels_stereo(opl, mix);
+  out[0] = saturate16(mix[0]);
+  out[1] = saturate16(mix[1]);
   if (opl->conv) {
     OPL_RateConv_putData(opl->conv, 0, out[0]);
     OPL_RateConv_putData(opl->conv, 1, out[1]);
   }
 }
 
+/* follow a DELTA-N or output rate change. The converter is kept so that its history carries over. */
+static void refresh_adpcm_conv(OPL *opl) {
+  const double f_inp = (double)(opl->clk / 72) * opl->adpcm->delta_n / 65536;
+
+  if (f_inp > 0) {
+    if (opl->adpcm_conv == NULL) {
+      opl->adpcm_conv = OPL_RateConv_new(f_inp, opl->rate, 1);
+      OPL_RateConv_reset(opl->adpcm_conv);
+    } else {
+      OPL_RateConv_setRatio(opl->adpcm_conv, f_inp, opl->rate);
+    }
+  }
+  opl->adpcm_conv_dirty = 0;
+}
+
+/* ADPCM output for one output sample: decoded at the delta-N rate and resampled to the output rate directly. */
+static INLINE int16_t calc_adpcm_native(OPL *opl, uint32_t ticks) {
+  const uint8_t play_start = opl->adpcm->play_start;
+  int16_t buf[16];
+  uint32_t i, n;
+
+  if (opl->mask & OPL_MASK_ADPCM)
+    return 0;
+
+  if (opl->adpcm_conv_dirty) {
+    refresh_adpcm_conv(opl);
+  }
+
+  /* not playing, SP-OFF or delta-N 0: the unit does not move and its output is constant. The converter is fed
+   * the held value until its history is flushed, then bypassed. */
+  if (opl->adpcm_idle) {
+    if (opl->adpcm_conv == NULL || opl->adpcm_conv_drain == 0 || opl->adpcm->delta_n == 0) {
+      return opl->adpcm_idle_out;
+    }
+    opl->adpcm_drain_addr += ticks * opl->adpcm->delta_n;
+    n = opl->adpcm_drain_addr >> 16;
+    opl->adpcm_drain_addr &= 0xffff;
+    for (i = 0; i < n && opl->adpcm_conv_drain > 0; i++, opl->adpcm_conv_drain--) {
+      OPL_RateConv_putData(opl->adpcm_conv, 0, opl->adpcm_idle_out);
+    }
+    return OPL_RateConv_getData(opl->adpcm_conv, 0);
+  }
+
+  if (opl->adpcm_conv == NULL) {
+    return opl->adpcm_idle_out;
+  }
+  opl->adpcm_conv_drain = LW;
+  opl->adpcm_drain_addr = 0;
+
+  while (ticks > 0) {
+    const uint32_t steps = min(ticks, 16);
+    n = OPL_ADPCM_calcNative(opl->adpcm, steps, buf);
+    for (i = 0; i < n; i++) {
+      OPL_RateConv_putData(opl->adpcm_conv, 0, buf[i]);
+    }
+    ticks -= steps;
+  }
+
+  if (play_start && !opl->adpcm->play_start) {
+    refresh_adpcm_idle(opl);
+    if (opl->events) {
+      push_event(opl, OPL_EVENT_ADPCM_EOS);
+    }
+    update_irq(opl, 1);
+  }
+
+  return OPL_RateConv_getData(opl->adpcm_conv, 0);
+}
+
 /***********************************************************
 
                    External Interfaces
 
 ***********************************************************/
 
+/* layout checks: a negative array size fails the build */
+typedef char opl_slot_fits_cache_line[sizeof(OPL_SLOT) <= OPL_CACHE_LINE ? 1 : -1];
+typedef char opl_hot_block_fits[offsetof(OPL, slot) <= OPL_HOT_LINES * OPL_CACHE_LINE ? 1 : -1];
+
 OPL *OPL_new(uint32_t clk, uint32_t rate) {
   OPL *opl;
+  void *base;
 
-  if (!table_initialized) {
-    initializeTables();
-  }
+#ifndef __cplusplus
+  INITIALIZE_TABLES();
+#endif
 
-  opl = (OPL *)calloc(1, sizeof(OPL));
-  if (opl == NULL)
+  /* calloc does not guarantee the cache-line alignment of slot[] and reg[] */
+  base = calloc(1, sizeof(OPL) + OPL_CACHE_LINE - 1);
+  if (base == NULL)
     return NULL;
+  opl = (OPL *)(((uintptr_t)base + OPL_CACHE_LINE - 1) & ~(uintptr_t)(OPL_CACHE_LINE - 1));
+  opl->alloc_base = base;
 
   opl->adpcm = NULL;
   opl->clk = clk;
@@ -1017,6 +1478,11 @@ OPL *OPL_new(uint32_t clk, uint32_t rate) {
   opl->timer1_user_data = NULL;
   opl->timer2_func = NULL;
   opl->timer2_user_data = NULL;
+  opl->irq_func = NULL;
+  opl->irq_user_data = NULL;
+  opl->events = NULL;
+  opl->queue = NULL;
+  opl->queue_cap = 0;
 
   OPL_reset(opl);
 
@@ -1028,16 +1494,26 @@ void OPL_delete(OPL *opl) {
     OPL_RateConv_delete(opl->conv);
     opl->conv = NULL;
   }
+  if (opl->adpcm_conv) {
+    OPL_RateConv_delete(opl->adpcm_conv);
+    opl->adpcm_conv = NULL;
+  }
   if (opl->adpcm) {
     OPL_ADPCM_delete(opl->adpcm);
     opl->adpcm = NULL;
   }
-  free(opl);
+  free(opl->queue);
+  free(opl->alloc_base);
 }
 
+/* master clock cycles per internal sample */
+static INLINE uint32_t clock_divider(OPL *opl) { return opl->chip_type == TYPE_YMF262 ? 288 : 72; }
+
+uint32_t OPL_internalRate(OPL *opl) { return opl->clk / clock_divider(opl); }
+
 static void reset_rate_conversion_params(OPL *opl) {
   const double f_out = opl->rate;
-  const double f_inp = opl->clk / 72;
+  const double f_inp = opl->clk / clock_divider(opl);
 
   opl->out_time = 0;
   opl->out_step = ((uint32_t)f_inp) << 8;
@@ -1048,13 +1524,18 @@ static void reset_rate_conversion_params(OPL *opl) {
     opl->conv = NULL;
   }
 
-  if (floor(f_inp) != f_out && floor(f_inp + 0.5) != f_out) {
+  if (!opl->on_bus && floor(f_inp) != f_out && floor(f_inp + 0.5) != f_out) {
     opl->conv = OPL_RateConv_new(f_inp, f_out, 2);
   }
 
   if (opl->conv) {
     OPL_RateConv_reset(opl->conv);
   }
+
+  opl->adpcm_conv_dirty = 1;
+  if (opl->adpcm_conv) {
+    OPL_RateConv_reset(opl->adpcm_conv);
+  }
 }
 
 void refresh_adpcm_object(OPL *opl) {
@@ -1064,13 +1545,14 @@ void refresh_adpcm_object(OPL *opl) {
     }
   } else {
     if (opl->adpcm != NULL) {
-      free(opl->adpcm);
+      OPL_ADPCM_delete(opl->adpcm);
       opl->adpcm = NULL;
     }
   }
   if (opl->adpcm != NULL) {
     OPL_ADPCM_reset(opl->adpcm);
   }
+  refresh_adpcm_idle(opl);
 }
 
 void OPL_reset(OPL *opl) {
@@ -1083,11 +1565,19 @@ void OPL_reset(OPL *opl) {
 
   opl->csm_mode = 0;
   opl->csm_key_count = 0;
-  opl->notesel = 0;
+  opl->notesel[0] = opl->notesel[1] = 0;
+  opl->test_flag[0] = opl->test_flag[1] = 0;
 
   opl->status = 0;
-  opl->timer1_counter = 0;
-  opl->timer2_counter = 0;
+  opl->tick = 0;
+  opl->timer1_start = opl->timer2_start = 0;
+  opl->timer1_period = 1024;
+  opl->timer2_period = 4096;
+  opl->timer_next = 0;
+
+  opl->sample_count = 0;
+  opl->queue_head = 0;
+  opl->queue_len = 0;
 
   opl->pm_phase = 0;
   opl->am_phase = 0;
@@ -1095,37 +1585,46 @@ void OPL_reset(OPL *opl) {
   opl->noise = 1;
   opl->mask = 0;
 
-  opl->rhythm_mode = 0;
+  opl->rhythm_mode[0] = opl->rhythm_mode[1] = 0;
   opl->slot_key_status = 0;
+  opl->key_status_ch = 0;
+  opl->key_status_rhythm = 0;
   opl->eg_counter = 0;
+  opl->slot_count = (opl->chip_type == TYPE_YMF262 || opl->dual) ? 36 : 18;
+  opl->four_op = 0;
 
   reset_rate_conversion_params(opl);
 
-  for (i = 0; i < 18; i++) {
+  for (i = 0; i < 36; i++) {
     reset_slot(&opl->slot[i], i);
   }
 
-  for (i = 0; i < 9; i++) {
+  for (i = 0; i < 18; i++) {
     opl->ch_alg[i] = 0;
   }
 
-  for (i = 0; i < 0x100; i++) {
+  for (i = 0; i < 0x200; i++) {
     opl->reg[i] = 0;
   }
   opl->reg[0x04] = 0x18; // MASK_EOS | MASK_BUF_RDY
 
   opl->pm_dphase = PM_DP_WIDTH / (1024 * 8);
+  update_lfo_am(opl);
+  update_lfo_pm(opl);
 
-  for (i = 0; i < 15; i++) {
+  for (i = 0; i < OPL_OUT_COUNT; i++) {
     opl->pan[i] = 3;
     opl->pan_fine[i][1] = opl->pan_fine[i][0] = 1.0f;
   }
 
-  for (i = 0; i < 15; i++) {
+  for (i = 0; i < OPL_OUT_COUNT; i++) {
     opl->ch_out[i] = 0;
   }
 
   refresh_adpcm_object(opl);
+
+  opl->block_tick = opl->tick;
+  update_irq(opl, 0);
 }
 
 void OPL_setRate(OPL *opl, uint32_t rate) {
@@ -1135,28 +1634,76 @@ void OPL_setRate(OPL *opl, uint32_t rate) {
 
 void OPL_setQuality(OPL *opl, uint8_t q) {}
 
+void OPL_setADPCMNativeRate(OPL *opl, uint8_t enable) {
+  opl->adpcm_native = enable ? 1 : 0;
+  opl->adpcm_conv_dirty = 1;
+  opl->ch_out[14] = 0;
+  if (!enable && opl->adpcm_conv) {
+    OPL_RateConv_delete(opl->adpcm_conv);
+    opl->adpcm_conv = NULL;
+  }
+}
+
 void OPL_setChipType(OPL *opl, uint8_t type) {
   if (type < TYPE_MAX) {
+    const uint8_t dual = opl->dual && (type == TYPE_YM3526 || type == TYPE_YM3812);
+    if ((type == TYPE_YMF262) != (opl->chip_type == TYPE_YMF262) || dual != opl->dual) {
+      opl->chip_type = type;
+      opl->dual = dual;
+      OPL_reset(opl);
+      return;
+    }
     opl->chip_type = type;
     refresh_adpcm_object(opl);
+    update_irq(opl, 0);
+  }
+}
+
+void OPL_setDualChip(OPL *opl, uint8_t enable) {
+  const uint8_t dual = enable && (opl->chip_type == TYPE_YM3526 || opl->chip_type == TYPE_YM3812);
+  if (dual != opl->dual) {
+    opl->dual = dual;
+    OPL_reset(opl);
   }
 }
 
 void OPL_writeIO(OPL *opl, uint32_t adr, uint8_t val) {
   if (adr & 1)
     OPL_writeReg(opl, opl->adr, val);
+  else if (opl->slot_count > 18)
+    opl->adr = ((adr & 2) << 7) | val;
   else
     opl->adr = val;
 }
 
-void OPL_setPan(OPL *opl, uint32_t ch, uint8_t pan) { opl->pan[ch & 15] = pan; }
+void OPL_setPan(OPL *opl, uint32_t ch, uint8_t pan) {
+  if (ch < OPL_OUT_COUNT)
+    opl->pan[ch] = pan;
+}
 
 void OPL_setPanFine(OPL *opl, uint32_t ch, float pan[2]) {
-  opl->pan_fine[ch & 15][0] = pan[0];
-  opl->pan_fine[ch & 15][1] = pan[1];
+  if (ch < OPL_OUT_COUNT) {
+    opl->pan_fine[ch][0] = pan[0];
+    opl->pan_fine[ch][1] = pan[1];
+  }
 }
 
-int16_t OPL_calc(OPL *opl) {
+static void apply_queue(OPL *opl) {
+  const uint32_t mask = opl->queue_cap - 1;
+  while (opl->queue_len && opl->queue[opl->queue_head].time <= opl->sample_count) {
+    const OPL_WRITE w = opl->queue[opl->queue_head];
+    opl->queue_head = (opl->queue_head + 1) & mask;
+    opl->queue_len--;
+    OPL_writeReg(opl, w.reg, w.val);
+  }
+}
+
+static INLINE int16_t calc_mono(OPL *opl) {
+  const uint32_t tick = opl->tick;
+  if (opl->queue_len) {
+    apply_queue(opl);
+  }
+  opl->sample_count++;
   while (opl->out_step > opl->out_time) {
     opl->out_time += opl->inp_step;
     update_output(opl);
@@ -1166,10 +1713,18 @@ int16_t OPL_calc(OPL *opl) {
   if (opl->conv) {
     opl->mix_out[0] = OPL_RateConv_getData(opl->conv, 0);
   }
+  if (opl->adpcm_native && opl->adpcm) {
+    return saturate16(opl->mix_out[0] + calc_adpcm_native(opl, opl->tick - tick));
+  }
   return opl->mix_out[0];
 }
 
-void OPL_calcStereo(OPL *opl, int32_t out[2]) {
+static INLINE void calc_stereo(OPL *opl, int32_t out[2]) {
+  const uint32_t tick = opl->tick;
+  if (opl->queue_len) {
+    apply_queue(opl);
+  }
+  opl->sample_count++;
   while (opl->out_step > opl->out_time) {
     opl->out_time += opl->inp_step;
     update_output(opl);
@@ -1183,6 +1738,176 @@ void OPL_calcStereo(OPL *opl, int32_t out[2]) {
     out[0] = opl->mix_out[0];
     out[1] = opl->mix_out[1];
   }
+  if (opl->adpcm_native && opl->adpcm) {
+    const int16_t adpcm = calc_adpcm_native(opl, opl->tick - tick);
+    if (opl->pan[14] & 2)
+      out[0] = saturate16(out[0] + (int32_t)(adpcm * opl->pan_fine[14][0]));
+    if (opl->pan[14] & 1)
+      out[1] = saturate16(out[1] + (int32_t)(adpcm * opl->pan_fine[14][1]));
+  }
+}
+
+int16_t OPL_calc(OPL *opl) {
+  int16_t res = calc_mono(opl);
+  opl->block_tick = opl->tick;
+  return res;
+}
+
+void OPL_calcStereo(OPL *opl, int32_t out[2]) {
+  calc_stereo(opl, out);
+  opl->block_tick = opl->tick;
+}
+
+static void begin_block(OPL *opl, OPL_EVENT *events, uint32_t max_events) {
+  opl->events = events;
+  opl->event_count = 0;
+  opl->event_max = events ? max_events : 0;
+  opl->event_dropped = 0;
+  opl->block_sample = 0;
+  if (events) {
+    opl->irq_line = OPL_status(opl) >> 7;
+  }
+}
+
+uint32_t OPL_droppedEvents(OPL *opl) { return opl->event_dropped; }
+
+static uint32_t end_block(OPL *opl) {
+  opl->events = NULL;
+  opl->block_tick = opl->tick;
+  return opl->event_count;
+}
+
+uint32_t OPL_calcBlock(OPL *opl, int16_t *out, uint32_t samples, OPL_EVENT *events, uint32_t max_events) {
+  uint32_t i;
+  begin_block(opl, events, max_events);
+  for (i = 0; i < samples; i++) {
+    opl->block_sample = i;
+    out[i] = calc_mono(opl);
+  }
+  return end_block(opl);
+}
+
+uint32_t OPL_calcStereoBlock(OPL *opl, int32_t *out, uint32_t samples, OPL_EVENT *events, uint32_t max_events) {
+  uint32_t i;
+  begin_block(opl, events, max_events);
+  for (i = 0; i < samples; i++) {
+    opl->block_sample = i;
+    calc_stereo(opl, out + i * 2);
+  }
+  return end_block(opl);
+}
+
+/***********************************************************
+
+                   Mixing Bus
+
+***********************************************************/
+
+OPL_BUS *OPL_BUS_new(uint32_t clk, uint32_t rate) {
+  const double f_out = rate;
+  const double f_inp = clk / 72;
+  OPL_BUS *bus;
+
+  bus = (OPL_BUS *)calloc(1, sizeof(OPL_BUS));
+  if (bus == NULL)
+    return NULL;
+
+  bus->clk = clk;
+  bus->rate = rate;
+  bus->out_time = 0;
+  bus->out_step = ((uint32_t)f_inp) << 8;
+  bus->inp_step = ((uint32_t)f_out) << 8;
+  bus->conv = NULL;
+  if (floor(f_inp) != f_out && floor(f_inp + 0.5) != f_out) {
+    bus->conv = OPL_RateConv_new(f_inp, f_out, 2);
+    if (bus->conv == NULL) {
+      free(bus);
+      return NULL;
+    }
+    OPL_RateConv_reset(bus->conv);
+  }
+
+  return bus;
+}
+
+void OPL_BUS_delete(OPL_BUS *bus) {
+  if (bus->conv) {
+    OPL_RateConv_delete(bus->conv);
+  }
+  free(bus);
+}
+
+int OPL_BUS_addChip(OPL_BUS *bus, OPL *opl) {
+  if (bus->count >= OPL_BUS_MAX_CHIPS || opl->clk / clock_divider(opl) != bus->clk / 72)
+    return -1;
+  OPL_setADPCMNativeRate(opl, 0);
+  opl->on_bus = 1;
+  if (opl->conv) {
+    OPL_RateConv_delete(opl->conv);
+    opl->conv = NULL;
+  }
+  bus->chip[bus->count] = opl;
+  bus->gain[bus->count][0] = bus->gain[bus->count][1] = 1.0f;
+  return bus->count++;
+}
+
+void OPL_BUS_setGain(OPL_BUS *bus, uint32_t index, float left, float right) {
+  if (index < bus->count) {
+    bus->gain[index][0] = left;
+    bus->gain[index][1] = right;
+  }
+}
+
+void OPL_BUS_calcStereo(OPL_BUS *bus, int32_t out[2]) {
+  uint32_t i;
+
+  for (i = 0; i < bus->count; i++) {
+    OPL *opl = bus->chip[i];
+    if (opl->queue_len) {
+      apply_queue(opl);
+    }
+    opl->sample_count++;
+  }
+
+  while (bus->out_step > bus->out_time) {
+    int32_t l = 0, r = 0;
+    bus->out_time += bus->inp_step;
+    for (i = 0; i < bus->count; i++) {
+      OPL *opl = bus->chip[i];
+      int32_t mix[2];
+      update_output(opl);
+      mix_channels_stereo(opl, mix);
+      l += (int32_t)(mix[0] * bus->gain[i][0]);
+      r += (int32_t)(mix[1] * bus->gain[i][1]);
+    }
+    if (bus->conv) {
+      OPL_RateConv_putData(bus->conv, 0, saturate16(l));
+      OPL_RateConv_putData(bus->conv, 1, saturate16(r));
+    } else {
+      bus->mix_out[0] = saturate16(l);
+      bus->mix_out[1] = saturate16(r);
+    }
+  }
+  bus->out_time -= bus->out_step;
+
+  if (bus->conv) {
+    out[0] = OPL_RateConv_getData(bus->conv, 0);
+    out[1] = OPL_RateConv_getData(bus->conv, 1);
+  } else {
+    out[0] = bus->mix_out[0];
+    out[1] = bus->mix_out[1];
+  }
+
+  for (i = 0; i < bus->count; i++) {
+    bus->chip[i]->block_tick = bus->chip[i]->tick;
+  }
+}
+
+void OPL_BUS_calcStereoBlock(OPL_BUS *bus, int32_t *out, uint32_t samples) {
+  uint32_t i;
+  for (i = 0; i < samples; i++) {
+    OPL_BUS_calcStereo(bus, out + i * 2);
+  }
 }
 
 uint32_t OPL_setMask(OPL *opl, uint32_t mask) {
@@ -1207,14 +1932,57 @@ uint32_t OPL_toggleMask(OPL *opl, uint32_t mask) {
     return 0;
 }
 
+/* b: bank of slots; rks of every slot of the bank depends on NOTESEL */
+static void set_notesel(OPL *opl, int b, uint8_t notesel) {
+  int i;
+  if (opl->notesel[b] == notesel)
+    return;
+  opl->notesel[b] = notesel;
+  for (i = b * 18; i < b * 18 + 18; i++) {
+    request_update(&opl->slot[i], UPDATE_RKS);
+  }
+}
+
+/* YMF262: set of channels paired by $104, effective while NEW is set */
+static void update_four_op(OPL *opl) {
+  const uint8_t conn = (opl->reg[0x105] & 1) ? opl->reg[0x104] & 0x3f : 0;
+  opl->four_op = (conn & 7) | ((uint32_t)(conn & 0x38) << 6);
+  rebuild_channel_keys(opl);
+  update_key_status(opl);
+}
+
+/* YMF262: left/right bits of $C0 select the outputs of the channel, or both while NEW is clear */
+static void update_stereo(OPL *opl, int ch, uint8_t data) {
+  const uint8_t pan = (opl->reg[0x105] & 1) ? (((data >> 4) & 1) << 1) | ((data >> 5) & 1) : 3;
+  opl->pan[OPL_OUT_CH(ch)] = pan;
+  if (ch == 6) {
+    opl->pan[9] = pan;
+  } else if (ch == 7) {
+    opl->pan[10] = opl->pan[11] = pan;
+  } else if (ch == 8) {
+    opl->pan[12] = opl->pan[13] = pan;
+  }
+}
+
 void OPL_writeReg(OPL *opl, uint32_t reg, uint8_t data) {
 
   int32_t s, c;
+  uint32_t r, so, co;
 
   static int32_t stbl[32] = {0,  2,  4,  1,  3,  5,  -1, -1, 6,  8,  10, 7,  9,  11, -1, -1,
                              12, 14, 16, 13, 15, 17, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
 
-  reg = reg & 0xff;
+  reg = reg & (opl->slot_count > 18 ? 0x1ff : 0xff);
+  r = reg & 0xff;
+  so = (reg >> 8) * 18; // first slot of the register set
+  co = (reg >> 8) * 9;  // first channel of the register set
+
+  if (reg == 0x0F && opl->adpcm != NULL) {
+    // ADPCM data streaming does not need the full register decode
+    opl->reg[0x0F] = data;
+    OPL_ADPCM_writeMemoryData(opl->adpcm, &data, 1);
+    return;
+  }
 
   if ((reg == 0x04) && (data & 0x80)) {
     // IRQ RESET
@@ -1223,6 +1991,7 @@ void OPL_writeReg(OPL *opl, uint32_t reg, uint8_t data) {
     if (opl->adpcm) {
       OPL_ADPCM_resetStatus(opl->adpcm);
     }
+    update_irq(opl, 0);
     return;
   }
 
@@ -1230,7 +1999,14 @@ void OPL_writeReg(OPL *opl, uint32_t reg, uint8_t data) {
 
   if (reg == 0x01) {
 
-    opl->test_flag = data;
+    opl->test_flag[0] = data;
+    if (!opl->dual) {
+      opl->test_flag[1] = data; /* YMF262: both register sets */
+    }
+
+  } else if (reg == 0x101 && opl->dual) {
+
+    opl->test_flag[1] = data;
 
   } else if (reg == 0x04) {
 
@@ -1240,95 +2016,233 @@ void OPL_writeReg(OPL *opl, uint32_t reg, uint8_t data) {
     if (data & 0x02) {
       latch_timer2(opl);
     }
+    schedule_timer(opl);
+    update_irq(opl, 0);
 
   } else if (0x07 <= reg && reg <= 0x12) {
 
     if (reg == 0x08) {
-      opl->csm_mode = (data >> 7) & 1;
-      opl->notesel = (data >> 6) & 1;
+      opl->csm_mode = opl->chip_type != TYPE_YMF262 && ((data >> 7) & 1);
+      set_notesel(opl, 0, (data >> 6) & 1);
+      if (!opl->dual) {
+        set_notesel(opl, 1, (data >> 6) & 1);
+      }
+      schedule_timer(opl);
     }
 
     if (opl->adpcm != NULL && opl->chip_type == TYPE_Y8950) {
       OPL_ADPCM_writeReg(opl->adpcm, reg, data);
+      refresh_adpcm_idle(opl);
+      if (reg == 0x07 && (data & 0x80) && opl->adpcm_conv) {
+        /* the unit restarts from 0: do not play the tail of the previous sample from the converter history */
+        OPL_RateConv_reset(opl->adpcm_conv);
+        opl->adpcm_conv_drain = 0;
+      }
+      if (reg == 0x10 || reg == 0x11) {
+        opl->adpcm_conv_dirty = 1;
+      }
     }
 
-  } else if (0x20 <= reg && reg < 0x40) {
+  } else if (0x20 <= r && r < 0x40) {
 
-    s = stbl[reg - 0x20];
+    s = stbl[r - 0x20];
     if (s >= 0) {
-      opl->slot[s].patch->AM = (data >> 7) & 1;
-      opl->slot[s].patch->PM = (data >> 6) & 1;
-      opl->slot[s].patch->EG = (data >> 5) & 1;
-      opl->slot[s].patch->KR = (data >> 4) & 1;
-      opl->slot[s].patch->ML = (data) & 15;
-      request_update(&(opl->slot[s]), UPDATE_ALL);
+      OPL_PATCH n = *opl->slot[s + so].patch;
+      n.AM = (data >> 7) & 1;
+      n.PM = (data >> 6) & 1;
+      n.EG = (data >> 5) & 1;
+      n.KR = (data >> 4) & 1;
+      n.ML = (data) & 15;
+      set_patch(&opl->slot[s + so], &n);
     }
 
-  } else if (0x40 <= reg && reg < 0x60) {
+  } else if (0x40 <= r && r < 0x60) {
 
-    s = stbl[reg - 0x40];
+    s = stbl[r - 0x40];
     if (s >= 0) {
-      opl->slot[s].patch->KL = (data >> 6) & 3;
-      opl->slot[s].patch->TL = (data) & 63;
-      request_update(&(opl->slot[s]), UPDATE_ALL);
+      OPL_PATCH n = *opl->slot[s + so].patch;
+      n.KL = (data >> 6) & 3;
+      n.TL = (data) & 63;
+      set_patch(&opl->slot[s + so], &n);
     }
 
-  } else if (0x60 <= reg && reg < 0x80) {
+  } else if (0x60 <= r && r < 0x80) {
 
-    s = stbl[reg - 0x60];
+    s = stbl[r - 0x60];
     if (s >= 0) {
-      opl->slot[s].patch->AR = (data >> 4) & 15;
-      opl->slot[s].patch->DR = (data) & 15;
-      request_update(&(opl->slot[s]), UPDATE_EG);
+      OPL_PATCH n = *opl->slot[s + so].patch;
+      n.AR = (data >> 4) & 15;
+      n.DR = (data) & 15;
+      set_patch(&opl->slot[s + so], &n);
     }
 
-  } else if (0x80 <= reg && reg < 0xa0) {
+  } else if (0x80 <= r && r < 0xa0) {
 
-    s = stbl[reg - 0x80];
+    s = stbl[r - 0x80];
     if (s >= 0) {
-      opl->slot[s].patch->SL = (data >> 4) & 15;
-      opl->slot[s].patch->RR = (data) & 15;
-      request_update(&(opl->slot[s]), UPDATE_EG);
+      OPL_PATCH n = *opl->slot[s + so].patch;
+      n.SL = (data >> 4) & 15;
+      n.RR = (data) & 15;
+      set_patch(&opl->slot[s + so], &n);
     }
 
-  } else if (0xa0 <= reg && reg < 0xa9) {
+  } else if (0xa0 <= r && r < 0xa9) {
 
-    c = reg - 0xa0;
-    set_fnumber(opl, c, data + ((opl->reg[reg + 0x10] & 3) << 8));
+    c = r - 0xa0 + co;
+    if (!BIT(opl->four_op << 3, c)) {
+      set_fnumber(opl, c, data + ((opl->reg[reg + 0x10] & 3) << 8));
+      if (BIT(opl->four_op, c)) {
+        set_fnumber(opl, c + 3, data + ((opl->reg[reg + 0x10] & 3) << 8));
+      }
+    }
 
-  } else if (0xb0 <= reg && reg < 0xb9) {
+  } else if (0xb0 <= r && r < 0xb9) {
 
-    c = reg - 0xb0;
-    set_fnumber(opl, c, ((data & 3) << 8) + opl->reg[reg - 0x10]);
-    set_block(opl, c, (data >> 2) & 7);
+    c = r - 0xb0 + co;
+    if (!BIT(opl->four_op << 3, c)) {
+      set_fnumber(opl, c, ((data & 3) << 8) + opl->reg[reg - 0x10]);
+      set_block(opl, c, (data >> 2) & 7);
+      if (BIT(opl->four_op, c)) {
+        set_fnumber(opl, c + 3, ((data & 3) << 8) + opl->reg[reg - 0x10]);
+        set_block(opl, c + 3, (data >> 2) & 7);
+      }
+    }
+    set_channel_key(opl, c, data & 0x20);
     update_key_status(opl);
 
-  } else if (0xc0 <= reg && reg < 0xc9) {
+  } else if (0xc0 <= r && r < 0xc9) {
 
-    c = reg - 0xc0;
+    c = r - 0xc0 + co;
     opl->slot[c * 2].patch->FB = (data >> 1) & 7;
     opl->ch_alg[c] = data & 1;
+    if (opl->chip_type == TYPE_YMF262) {
+      update_stereo(opl, c, data);
+    }
 
-  } else if (reg == 0xbd) {
+  } else if (reg == 0xbd || (reg == 0x1bd && opl->dual)) {
 
-    update_rhythm_mode(opl);
+    const int b = reg >> 8;
+    update_rhythm_mode(opl, b);
+    update_rhythm_keys(opl);
     update_key_status(opl);
-    opl->am_mode = (data >> 7) & 1;
-    opl->pm_mode = (data >> 6) & 1;
+    opl->am_mode[b] = (data >> 7) & 1;
+    opl->pm_mode[b] = (data >> 6) & 1;
+    if (!opl->dual) {
+      opl->am_mode[1] = opl->am_mode[0];
+      opl->pm_mode[1] = opl->pm_mode[0];
+    }
+    update_lfo_am(opl);
+    update_lfo_pm(opl);
 
-  } else if (0xe0 <= reg && reg < 0x100) {
-    if (opl->chip_type == TYPE_YM3812 && (opl->reg[0x01] & 0x20)) {
-      s = stbl[reg - 0xe0];
+  } else if (0xe0 <= r) {
+    if (opl->chip_type == TYPE_YMF262) {
+      s = stbl[r - 0xe0];
       if (s >= 0) {
-        opl->slot[s].patch->WS = data & 3;
-        request_update(&(opl->slot[s]), UPDATE_WS);
+        OPL_PATCH n = *opl->slot[s + so].patch;
+        n.WS = data & ((opl->reg[0x105] & 1) ? 7 : 3);
+        set_patch(&opl->slot[s + so], &n);
+      }
+    } else if (opl->chip_type == TYPE_YM3812 && (opl->reg[(reg & 0x100) | 0x01] & 0x20)) {
+      s = stbl[r - 0xe0];
+      if (s >= 0) {
+        OPL_PATCH n = *opl->slot[s + so].patch;
+        n.WS = data & 3;
+        set_patch(&opl->slot[s + so], &n);
       }
     }
+
+  } else if (reg == 0x108 && opl->dual) {
+
+    set_notesel(opl, 1, (data >> 6) & 1);
+
+  } else if ((reg == 0x104 || reg == 0x105) && opl->chip_type == TYPE_YMF262) {
+
+    update_four_op(opl);
   }
 }
 
 uint8_t OPL_readIO(OPL *opl) { return opl->reg[opl->adr]; }
 
+void OPL_setChannelPatch(OPL *opl, uint32_t ch, const OPL_PATCH mod_car[2], uint8_t fb, uint8_t alg) {
+  const uint8_t opl3 = opl->chip_type == TYPE_YMF262;
+  const uint32_t bank = ch < 9 ? 0 : 0x100;
+  const uint8_t wse = opl3 || (opl->chip_type == TYPE_YM3812 && (opl->reg[bank | 0x01] & 0x20));
+  const uint8_t ws_mask = (opl3 && (opl->reg[0x105] & 1)) ? 7 : 3;
+  const uint32_t c = ch % 9;
+  int k;
+
+  if (ch >= opl->slot_count / 2U)
+    return;
+
+  for (k = 0; k < 2; k++) {
+    OPL_SLOT *slot = &opl->slot[ch * 2 + k];
+    OPL_PATCH *p = slot->patch;
+    const OPL_PATCH *q = &mod_car[k];
+    const uint32_t r = bank + (c / 3) * 8 + (c % 3) + k * 3;
+    OPL_PATCH n = *p;
+
+    n.AM = q->AM & 1;
+    n.PM = q->PM & 1;
+    n.EG = q->EG & 1;
+    n.KR = q->KR & 1;
+    n.ML = q->ML & 15;
+    n.KL = q->KL & 3;
+    n.TL = q->TL & 63;
+    n.AR = q->AR & 15;
+    n.DR = q->DR & 15;
+    n.SL = q->SL & 15;
+    n.RR = q->RR & 15;
+    if (wse) {
+      n.WS = q->WS & ws_mask;
+    }
+
+    set_patch(slot, &n);
+
+    opl->reg[0x20 + r] = (n.AM << 7) | (n.PM << 6) | (n.EG << 5) | (n.KR << 4) | n.ML;
+    opl->reg[0x40 + r] = (n.KL << 6) | n.TL;
+    opl->reg[0x60 + r] = (n.AR << 4) | n.DR;
+    opl->reg[0x80 + r] = (n.SL << 4) | n.RR;
+    opl->reg[0xe0 + r] = q->WS & (opl3 ? 7 : 3);
+  }
+
+  opl->slot[ch * 2].patch->FB = fb & 7;
+  opl->ch_alg[ch] = alg & 1;
+  opl->reg[0xc0 + bank + c] = (opl->reg[0xc0 + bank + c] & 0xf0) | ((fb & 7) << 1) | (alg & 1);
+}
+
+uint8_t OPL_queueWrite(OPL *opl, uint64_t time, uint32_t reg, uint8_t val) {
+  uint32_t i, mask;
+
+  if (opl->queue_len == opl->queue_cap) {
+    const uint32_t cap = opl->queue_cap ? opl->queue_cap * 2 : 64;
+    OPL_WRITE *queue = (OPL_WRITE *)malloc(sizeof(OPL_WRITE) * cap);
+    if (queue == NULL)
+      return 0;
+    for (i = 0; i < opl->queue_len; i++) {
+      queue[i] = opl->queue[(opl->queue_head + i) & (opl->queue_cap - 1)];
+    }
+    free(opl->queue);
+    opl->queue = queue;
+    opl->queue_cap = cap;
+    opl->queue_head = 0;
+  }
+
+  /* insert from the tail, so writes queued in time order are appended without moving others */
+  mask = opl->queue_cap - 1;
+  for (i = opl->queue_len; i > 0; i--) {
+    const OPL_WRITE *prev = &opl->queue[(opl->queue_head + i - 1) & mask];
+    if (prev->time <= time)
+      break;
+    opl->queue[(opl->queue_head + i) & mask] = *prev;
+  }
+  opl->queue[(opl->queue_head + i) & mask].time = time;
+  opl->queue[(opl->queue_head + i) & mask].reg = reg;
+  opl->queue[(opl->queue_head + i) & mask].val = val;
+  opl->queue_len++;
+
+  return 1;
+}
+
 uint8_t OPL_status(OPL *opl) {
   uint8_t status = opl->status;
 
@@ -1344,12 +2258,53 @@ uint8_t OPL_status(OPL *opl) {
   return status & 0x7f; // IRQ = 0
 }
 
-void OPL_writeADPCMData(OPL *opl, uint8_t type, uint32_t start, uint32_t length, const uint8_t *data) {
+void OPL_setIRQCallback(OPL *opl, void (*func)(void *user, uint8_t irq, uint32_t offset), void *user) {
+  opl->irq_func = NULL;
+  opl->irq_line = OPL_status(opl) >> 7;
+  opl->irq_user_data = user;
+  opl->irq_func = func;
+}
+
+uint8_t OPL_writeADPCMStream(OPL *opl, const uint8_t *data, uint32_t length) {
+  if (length == 0)
+    return 1;
+
+  opl->reg[0x0F] = data[length - 1];
+  if (opl->adpcm != NULL) {
+    return OPL_ADPCM_writeMemoryData(opl->adpcm, data, length);
+  }
+  return 1;
+}
+
+uint32_t OPL_nextEventCycles(OPL *opl) {
+  uint32_t ticks = 0xFFFFFFFF;
+  uint64_t cycles;
+
+  if (opl->reg[0x04] & 0x01) {
+    ticks = min(ticks, opl->timer1_start + opl->timer1_period - opl->tick);
+  }
+  if (opl->reg[0x04] & 0x02) {
+    ticks = min(ticks, opl->timer2_start + opl->timer2_period - opl->tick);
+  }
+  if (opl->adpcm && !(opl->mask & OPL_MASK_ADPCM)) { /* a masked unit is not stepped */
+    ticks = min(ticks, OPL_ADPCM_nextEventSteps(opl->adpcm));
+  }
+  if (ticks == 0xFFFFFFFF) {
+    return 0xFFFFFFFF;
+  }
+
+  /* the last output sample ended out_time / inp_step ticks before opl->tick */
+  cycles = ((uint64_t)ticks * opl->inp_step + opl->out_time) * clock_divider(opl) / opl->inp_step;
+  return cycles < 0xFFFFFFFF ? (uint32_t)cycles : 0xFFFFFFFF;
+}
+
+uint8_t OPL_writeADPCMData(OPL *opl, uint8_t type, uint32_t start, uint32_t length, const uint8_t *data) {
   if (opl->adpcm != NULL) {
     if (type == 0) {
-      OPL_ADPCM_writeRAM(opl->adpcm, start, length, data);
+      return OPL_ADPCM_writeRAM(opl->adpcm, start, length, data);
     } else {
-      OPL_ADPCM_writeROM(opl->adpcm, start, length, data);
+      return OPL_ADPCM_writeROM(opl->adpcm, start, length, data);
     }
   }
+  return 1;
 }
\ No newline at end of file
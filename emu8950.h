@@ -15,8 +15,12 @@ typedef struct __OPL_PATCH {
   uint8_t TL, FB, EG, ML, AR, DR, SL, RR, KR, KL, AM, PM, WS;
 } OPL_PATCH;
 
+/* channel output index: 0..8 for channels 0..8, 15..23 for channels 9..17 (YMF262 or the second chip of dual mode) */
+#define OPL_OUT_CH(x) ((x) < 9 ? (x) : (x) + 6)
+#define OPL_OUT_COUNT 29
+
 /* mask */
-#define OPL_MASK_CH(x) (1 << (x))
+#define OPL_MASK_CH(x) (1 << OPL_OUT_CH(x))
 #define OPL_MASK_HH (1 << 9)
 #define OPL_MASK_CYM (1 << 10)
 #define OPL_MASK_TOM (1 << 11)
@@ -24,6 +28,28 @@ typedef struct __OPL_PATCH {
 #define OPL_MASK_BD (1 << 13)
 #define OPL_MASK_ADPCM (1 << 14)
 #define OPL_MASK_RHYTHM (OPL_MASK_HH | OPL_MASK_CYM | OPL_MASK_TOM | OPL_MASK_SD | OPL_MASK_BD)
+/* the same outputs of the second chip in dual mode (see OPL_setDualChip) */
+#define OPL_MASK_DUAL(x) ((x) << 15)
+
+/* event types reported by block render calls */
+#define OPL_EVENT_TIMER1 1
+#define OPL_EVENT_TIMER2 2
+#define OPL_EVENT_CSM_KEY_ON 3
+#define OPL_EVENT_ADPCM_EOS 4
+#define OPL_EVENT_IRQ_ON 5
+#define OPL_EVENT_IRQ_OFF 6
+
+typedef struct __OPL_EVENT {
+  uint32_t offset; /* output sample index in the block */
+  uint8_t type;    /* OPL_EVENT_* */
+} OPL_EVENT;
+
+/* register write scheduled at an output sample time (see OPL_queueWrite) */
+typedef struct __OPL_WRITE {
+  uint64_t time; /* output sample count at which the write is applied */
+  uint32_t reg;
+  uint8_t val;
+} OPL_WRITE;
 
 /* rate conveter */
 typedef struct __OPL_RateConv {
@@ -36,12 +62,50 @@ typedef struct __OPL_RateConv {
 
 OPL_RateConv *OPL_RateConv_new(double f_inp, double f_out, int ch);
 void OPL_RateConv_reset(OPL_RateConv *conv);
+/* change the conversion ratio without clearing the buffered input */
+void OPL_RateConv_setRatio(OPL_RateConv *conv, double f_inp, double f_out);
 void OPL_RateConv_putData(OPL_RateConv *conv, int ch, int16_t data);
 int16_t OPL_RateConv_getData(OPL_RateConv *conv, int ch);
 void OPL_RateConv_delete(OPL_RateConv *conv);
 
-/* slot */
+/* cache-line alignment of the per-sample state */
+#define OPL_CACHE_LINE 64
+#if defined(_MSC_VER)
+#define OPL_CACHE_ALIGN __declspec(align(64))
+#elif defined(__GNUC__)
+#define OPL_CACHE_ALIGN __attribute__((aligned(64)))
+#else
+#define OPL_CACHE_ALIGN
+#endif
+
+/* slot: one cache line */
 typedef struct __OPL_SLOT {
+  /* phase generator (pg) */
+  const uint16_t *wave_table; /* wave table */
+  OPL_PATCH *patch;           /* = alias for __patch */
+
+  uint32_t pg_phase; /* pg phase */
+  uint32_t pg_inc;   /* phase increment without pm, doubled: (fnum * ml) << blk */
+  uint16_t pg_mul;   /* phase increment per f-number step, doubled: ml << blk */
+  uint16_t pg_out;   /* pg output, as index of wave table */
+  uint16_t blk_fnum; /* (block << 9) | f-number */
+  uint16_t fnum;     /* f-number (9 bits) */
+
+  /* slot output */
+  int16_t output[2]; /* output value, latest and previous. */
+
+  /* envelope generator (eg) */
+  uint16_t tll;              /* total level + key scale level*/
+  int16_t eg_out;            /* eg output */
+  uint8_t eg_state;          /* current state */
+  uint8_t eg_shift;          /* shift for eg global counter, controls envelope speed */
+  uint8_t eg_rate_h;         /* eg speed rate high 4bits */
+  uint8_t eg_rate_l;         /* eg speed rate low 2bits */
+  uint8_t rks;               /* key scale offset (rks) for eg speed */
+  uint8_t update_requests;   /* flags to debounce update */
+
+  uint8_t blk;     /* block (3 bits) */
+  uint8_t pg_keep; /* if 1, pg_phase is preserved when key-on */
   uint8_t number;
 
   /* type flags:
@@ -51,99 +115,135 @@ typedef struct __OPL_SLOT {
    */
   uint8_t type;
 
-  OPL_PATCH __patch;  
-  OPL_PATCH *patch;  /* = alias for __patch */
-
-  /* slot output */
-  int32_t output[2]; /* output value, latest and previous. */
-
-  /* phase generator (pg) */
-  uint16_t *wave_table; /* wave table */
-  uint32_t pg_phase;    /* pg phase */
-  uint32_t pg_out;      /* pg output, as index of wave table */
-  uint8_t pg_keep;      /* if 1, pg_phase is preserved when key-on */
-  uint16_t blk_fnum;    /* (block << 9) | f-number */
-  uint16_t fnum;        /* f-number (9 bits) */
-  uint8_t blk;          /* block (3 bits) */
-
-  /* envelope generator (eg) */
-  uint8_t eg_state;         /* current state */
-  uint16_t tll;             /* total level + key scale level*/
-  uint8_t rks;              /* key scale offset (rks) for eg speed */
-  uint8_t eg_rate_h;        /* eg speed rate high 4bits */
-  uint8_t eg_rate_l;        /* eg speed rate low 2bits */
-  uint32_t eg_shift;        /* shift for eg global counter, controls envelope speed */
-  int16_t eg_out;           /* eg output */
-
-  uint32_t update_requests; /* flags to debounce update */
+  OPL_PATCH __patch;
 
 #if OPL_DEBUG
   uint8_t last_eg_state;
 #endif
 } OPL_SLOT;
 
-typedef struct __OPL {
-  OPL_ADPCM *adpcm;
-  uint32_t clk;
-  uint32_t rate;
-
-  uint8_t chip_type;
-
-  uint32_t adr;
+/* cache lines of the per-sample fields of OPL in front of slot[] */
+#define OPL_HOT_LINES 8
 
-  uint8_t csm_mode;
-  uint8_t csm_key_count;
-  uint8_t notesel;
+typedef struct __OPL {
+  /* per-sample state (hot): the fields below up to slot[] fit in OPL_HOT_LINES cache lines */
+  uint32_t tick;       // number of synthesized samples at clock/72
+  uint32_t timer_next; // tick at which the timer unit is processed next
+  uint32_t eg_counter;
+  uint32_t pm_phase;
+  uint32_t pm_dphase;
+  uint32_t am_phase; /* wraps at 210 steps of 64 ticks */
+  uint32_t noise;
+  uint32_t mask;
+  uint32_t four_op; /* YMF262: bitmask of channels (0-2, 9-11) paired with ch + 3 as 4-operator channels */
 
   uint32_t inp_step;
   uint32_t out_step;
   uint32_t out_time;
+  uint32_t queue_len;     // writes pending in queue
+  uint64_t sample_count;  // output samples calculated since reset
 
-  uint8_t reg[0x100];
-  uint8_t test_flag;
-  uint32_t slot_key_status;
-  uint8_t rhythm_mode;
+  OPL_ADPCM *adpcm;
+  OPL_RateConv *conv;
+  uint8_t on_bus; /* rendered by an OPL_BUS, which resamples the mix; conv is not used */
 
-  uint32_t eg_counter;
+  uint8_t chip_type;
+  uint8_t slot_count; /* 18, or 36 on YMF262 and in dual mode */
+  uint8_t dual;       /* second YM3526/YM3812 on slots 18..35 (see OPL_setDualChip) */
+  uint8_t test_flag[2]; /* $01, and $101 of the second chip in dual mode; the LFO follows [0] */
+  uint8_t notesel[2];     /* [1]: slots 18..35 */
+  uint8_t rhythm_mode[2]; /* [1]: second chip of dual mode */
+  uint8_t am_mode[2];
+  uint8_t pm_mode[2];
+  uint8_t lfo_am[2];    /* [1]: slots 18..35 */
+  int8_t lfo_pm[2][8];  /* f-number offset by fnum >> 7, updated when the PM step changes */
+  uint8_t short_noise[2];
+
+  uint8_t adpcm_idle;     /* 1 while the ADPCM output is constant */
+  uint8_t adpcm_native;   /* ADPCM synthesized at its own delta-N rate (see OPL_setADPCMNativeRate) */
+  int16_t adpcm_idle_out; /* the constant ADPCM output */
+
+  uint8_t ch_alg[18]; // alg for each channels
 
-  uint32_t pm_phase;
-  uint32_t pm_dphase;
+  /* channel output */
+  /* 0..8:tone 9:bd 10:hh 11:sd 12:tom 13:cym 14:adpcm 15..23:tone 9..17 24..28:bd..cym of the second chip */
+  int16_t ch_out[OPL_OUT_COUNT];
+  int16_t mix_out[2];
 
-  int32_t am_phase;
-  int32_t am_dphase;
-  uint8_t lfo_am;
+  uint8_t pan[OPL_OUT_COUNT];
+  float pan_fine[OPL_OUT_COUNT][2];
 
-  uint32_t noise;
-  uint8_t short_noise;
+  OPL_CACHE_ALIGN OPL_SLOT slot[36]; /* 18..35: YMF262 channels 9..17, or the second chip of dual mode */
 
-  OPL_SLOT slot[18];
-  uint8_t ch_alg[9]; // alg for each channels
+  /* control state (cold): touched by register writes, timer events and API calls */
+  OPL_CACHE_ALIGN uint8_t reg[0x200]; /* $100-$1FF: YMF262 or the second chip of dual mode */
 
-  uint8_t pan[16];
-  float pan_fine[16][2];
+  uint32_t clk;
+  uint32_t rate;
+  uint32_t adr;
 
-  uint32_t mask;
-  uint8_t am_mode;
-  uint8_t pm_mode;
+  uint8_t csm_mode;
+  uint8_t csm_key_count;
 
-  /* channel output */
-  /* 0..8:tone 9:bd 10:hh 11:sd 12:tom 13:cym 14:adpcm */
-  int16_t ch_out[15];
+  uint64_t slot_key_status;
+  uint64_t key_status_ch;     /* slots keyed by $B0 (4-operator pairs follow their first channel) */
+  uint64_t key_status_rhythm; /* slots keyed by $BD (and $1BD in dual mode) */
 
-  int16_t mix_out[2];
+  int32_t am_dphase;
 
-  OPL_RateConv *conv;
+  uint8_t adpcm_conv_dirty;
+  OPL_RateConv *adpcm_conv;
+  uint8_t adpcm_conv_drain;    /* constant input samples still to feed adpcm_conv after the unit went idle */
+  uint32_t adpcm_drain_addr;   /* delta-N phase of that feed */
 
-  uint32_t timer1_counter; //  80us counter
-  uint32_t timer2_counter; // 320us counter
+  uint32_t timer1_start;  // tick when timer1 was (re)loaded
+  uint32_t timer1_period; // ticks until timer1 overflow (80us unit)
+  uint32_t timer2_start;  // tick when timer2 was (re)loaded
+  uint32_t timer2_period; // ticks until timer2 overflow (320us unit)
   void *timer1_user_data;
   void *timer2_user_data;
   void (*timer1_func)(void *user);
   void (*timer2_func)(void *user);
   uint8_t status;
 
+  uint32_t block_tick; // tick at the beginning of the current calc call
+  uint8_t irq_line;
+  void *irq_user_data;
+  void (*irq_func)(void *user, uint8_t irq, uint32_t offset);
+
+  /* event output of the current block render call */
+  OPL_EVENT *events;
+  uint32_t event_count;
+  uint32_t event_max;
+  uint32_t event_dropped; /* events lost because event_max was reached */
+  uint32_t block_sample;
+
+  /* timestamped register writes, sorted by time */
+  OPL_WRITE *queue;
+  uint32_t queue_head;
+  uint32_t queue_cap; // power of 2
+
+  void *alloc_base; /* start of the allocation holding this cache-aligned object */
+
 } OPL;
 
+#define OPL_BUS_MAX_CHIPS 4
+
+/* chips at the same clock mixed at the internal rate and resampled once */
+typedef struct __OPL_BUS {
+  uint32_t clk;
+  uint32_t rate;
+  uint32_t count;
+  OPL *chip[OPL_BUS_MAX_CHIPS];
+  float gain[OPL_BUS_MAX_CHIPS][2]; /* left, right */
+
+  OPL_RateConv *conv;
+  uint32_t out_time;
+  uint32_t out_step;
+  uint32_t inp_step;
+  int32_t mix_out[2];
+} OPL_BUS;
+
 OPL *OPL_new(uint32_t clk, uint32_t rate);
 void OPL_delete(OPL *);
 
@@ -155,21 +255,58 @@ void OPL_reset(OPL *);
  */
 void OPL_setRate(OPL *opl, uint32_t rate);
 
+/**
+ * Internal sample rate of the chip: clock / 72, or clock / 288 on YMF262.
+ * Frequencies of f-numbers are fnum * rate / 2^(20 - block).
+ */
+uint32_t OPL_internalRate(OPL *opl);
+
 /** 
  * Set internal calcuration quality. Currently no effects, just for compatibility.
  * >= v1.0.0 always synthesizes internal output at clock/72 Hz.
  */
 void OPL_setQuality(OPL *opl, uint8_t q);
 
+/**
+ * Synthesize ADPCM at its native delta-N rate and resample it directly to the output rate,
+ * instead of stepping it at clock/72 and mixing it before the rate converter.
+ * The cost of ADPCM then follows its own sample rate. Disabled by default.
+ * @param enable 1:native rate 0:clock/72 (bit-exact with the chip)
+ */
+void OPL_setADPCMNativeRate(OPL *opl, uint8_t enable);
+
 /**
  * Set OPL chip type.
- * @param type 0:Y8950, 1:YM3526, 2:YM3812
+ * @param type 0:Y8950, 1:YM3526, 2:YM3812, 3:YMF262
+ *
+ * YMF262 (OPL3) runs the same slot engine with 36 slots at clock/288 (14.31818MHz for the usual 49716Hz).
+ * Registers $100-$1FF are the second register set; OPL_writeIO selects it by writes to the address port
+ * with bit 1 of the port number set. With NEW ($105 bit 0) set, waveforms 4-7 are available, $104 pairs
+ * channels 0-2 and 9-11 with ch + 3 into 4-operator channels (output on ch + 3, as the key, f-number and block
+ * of ch + 3 follow ch), and the left/right bits of $C0 drive the pan setting of the channel (see OPL_setPan);
+ * waveform and stereo bits take the NEW state at the time they are written. $C0 bits 6-7 (outputs C and D)
+ * are ignored. Switching to or from YMF262 resets the chip.
  */
 void OPL_setChipType(OPL *opl, uint8_t type);
 
+/**
+ * Run a second YM3526/YM3812 in the same engine, for dual-chip configurations (such as the dual-chip flag of VGM).
+ * Registers of the second chip are at $100-$1FF (ports 2 and 3 of OPL_writeIO), its channels are 9..17 and its
+ * outputs are at the output index of the first chip + 15 (see OPL_setPan and OPL_MASK_DUAL). The 36 slots are
+ * stepped in one pass and mixed before the single rate converter.
+ * Timers, status and IRQ are those of the first chip; the timer and CSM bits of the second chip are stored
+ * but have no effect. The envelope and phase test bits ($01/$101 D0, D2) act on their own chip. Noise and LFO
+ * phase are shared, as on two chips reset together, so the LFO test bits (D1, D3) of the first chip act on
+ * both chips and those of the second chip have no effect.
+ * Not available on Y8950 and YMF262 (setting either chip type leaves dual mode). Changing the mode resets the chip.
+ * @param enable 1:dual 0:single
+ */
+void OPL_setDualChip(OPL *opl, uint8_t enable);
+
 /** 
  * Set pan pot (extra function - not YM2413 chip feature)
- * @param ch 0..8:tone 9:bd 10:hh 11:sd 12:tom 13:cym 14,15:reserved
+ * @param ch 0..8:tone 9:bd 10:hh 11:sd 12:tom 13:cym 14:adpcm 15..23:tone 9..17 (OPL_OUT_CH)
+ *           24..28: bd, hh, sd, tom and cym of the second chip in dual mode
  * @param pan 0:mute 1:right 2:left 3:center 
  * ```
  * pan: 76543210
@@ -181,7 +318,7 @@ void OPL_setPan(OPL *opl, uint32_t ch, uint8_t pan);
 
 /**
  * Set fine-grained panning
- * @param ch 0..8:tone 9:bd 10:hh 11:sd 12:tom 13:cym 14,15:reserved
+ * @param ch same as OPL_setPan
  * @param pan output strength of left/right channel. 
  *            pan[0]: left, pan[1]: right. pan[0]=pan[1]=1.0f for center.
  */
@@ -190,6 +327,29 @@ void OPL_setPanFine(OPL *opl, uint32_t ch, float pan[2]);
 void OPL_writeIO(OPL *opl, uint32_t reg, uint8_t val);
 void OPL_writeReg(OPL *opl, uint32_t reg, uint8_t val);
 
+/**
+ * Load an instrument into a channel at once.
+ * Same result as writing $20, $40, $60, $80 and $E0 of both slots and $C0 of the channel, but skips the
+ * register decode and does not recalculate the level and waveform when they are unchanged.
+ * WS is applied only on YM3812 with waveform select enabled, or on YMF262, as with $E0. The FB field of the
+ * patches is ignored, and the stereo bits of $C0 are kept.
+ * @param ch channel 0..8, or 0..17 on YMF262 and in dual mode
+ * @param mod_car [0] modulator, [1] carrier
+ * @param fb feedback 0..7
+ * @param alg connection 0:FM 1:AM
+ */
+void OPL_setChannelPatch(OPL *opl, uint32_t ch, const OPL_PATCH mod_car[2], uint8_t fb, uint8_t alg);
+
+/**
+ * Schedule a register write at an output sample time.
+ * The write is applied just before the output sample numbered `time` (opl->sample_count) is calculated,
+ * by any of the calc functions. Writes with the same time are applied in the order queued, and writes
+ * whose time has already passed are applied before the next sample. OPL_reset drops pending writes and
+ * restarts sample_count from 0.
+ * @returns 1 on success, 0 if the queue could not be grown.
+ */
+uint8_t OPL_queueWrite(OPL *opl, uint64_t time, uint32_t reg, uint8_t val);
+
 /**
  * Calculate sample
  */
@@ -200,10 +360,36 @@ int16_t OPL_calc(OPL *opl);
  */
 void OPL_calcStereo(OPL *opl, int32_t out[2]);
 
+/**
+ * Calculate a block of mono samples.
+ * @param out buffer for `samples` samples.
+ * @param events if not NULL, timer, CSM key-on, ADPCM EOS and IRQ edge events are stored here in order
+ *               of occurrence instead of invoking timer1_func, timer2_func and the IRQ callback.
+ *               Events exceeding max_events are dropped and counted (see OPL_droppedEvents).
+ * @returns number of events stored.
+ */
+uint32_t OPL_calcBlock(OPL *opl, int16_t *out, uint32_t samples, OPL_EVENT *events, uint32_t max_events);
+
+/**
+ * Calculate a block of stereo samples.
+ * @param out interleaved L/R buffer for `samples` frames.
+ * @param events same as OPL_calcBlock.
+ * @returns number of events stored.
+ */
+uint32_t OPL_calcStereoBlock(OPL *opl, int32_t *out, uint32_t samples, OPL_EVENT *events, uint32_t max_events);
+
+/**
+ * Number of events the last OPL_calcBlock/OPL_calcStereoBlock call dropped because max_events was reached.
+ * 0 means the returned events are complete.
+ */
+uint32_t OPL_droppedEvents(OPL *opl);
+
 /** 
  *  Set channel mask 
  *  @param mask mask flag: OPL_MASK_* can be used.
  *  - bit 0..8: mask for ch 1 to 9 (OPL_MASK_CH(i))
+ *  - bit 15..23: mask for ch 10 to 18 of YMF262 or dual mode (OPL_MASK_CH(i))
+ *  - bit 24..28: rhythm of the second chip in dual mode (OPL_MASK_DUAL(OPL_MASK_HH) etc.)
  *  - bit 9: mask for Hi-Hat (OPL_MASK_HH)
  *  - bit 10: mask for Top-Cym (OPL_MASK_CYM)
  *  - bit 11: mask for Tom (OPL_MASK_TOM)
@@ -232,7 +418,70 @@ uint8_t OPL_readIO(OPL *opl);
  */
 uint8_t OPL_status(OPL *opl);
 
-void OPL_writeADPCMData(OPL *opl, uint8_t type, uint32_t start, uint32_t length, const uint8_t *data);
+/**
+ * Set a callback invoked on every IRQ line transition (D7 of OPL_status).
+ * Masks in register $04 are respected and ADPCM EOS is covered as well as the timers.
+ * @param func called with irq=1 on the rising edge and irq=0 on the falling edge.
+ *             offset is the 0-based index of the internal tick (clock/72, clock/288 on YMF262) within the
+ *             current OPL_calc/OPL_calcStereo/block call in which the transition happened, so an edge on the
+ *             first tick reports 0. Unlike OPL_EVENT offsets, which count output samples, this is in internal
+ *             ticks. Transitions caused by register writes report the index of the next tick.
+ * @param user user data passed to func.
+ */
+void OPL_setIRQCallback(OPL *opl, void (*func)(void *user, uint8_t irq, uint32_t offset), void *user);
+
+/**
+ * Predict the next status change.
+ * @returns number of clock cycles until the next TIMER1/TIMER2 overflow or ADPCM EOS, counted from the end of
+ * the last output sample (internal ticks already synthesized past it are taken into account).
+ * 0xFFFFFFFF if no event is pending. EOS of a masked ADPCM unit (OPL_MASK_ADPCM) is not predicted.
+ * BUF_RDY is not included since it always reads as 1 on this emulator.
+ */
+uint32_t OPL_nextEventCycles(OPL *opl);
+
+/**
+ * Upload ADPCM RAM (type 0) or ROM (type 1) data.
+ * @returns 0 if memory for the data could not be allocated (part of it is not stored), 1 otherwise.
+ */
+uint8_t OPL_writeADPCMData(OPL *opl, uint8_t type, uint32_t start, uint32_t length, const uint8_t *data);
+
+/**
+ * Write a sequence of bytes to register $0F (ADPCM DATA).
+ * Equivalent to calling OPL_writeReg(opl, 0x0F, data[i]) for each byte, but memory-data transfers
+ * are copied into the ADPCM memory in runs.
+ * @returns 0 if some bytes were dropped because memory could not be allocated. Single writes through
+ * OPL_writeReg report this through OPL_ADPCM_memoryError(opl->adpcm).
+ */
+uint8_t OPL_writeADPCMStream(OPL *opl, const uint8_t *data, uint32_t length);
+
+/**
+ * Create a mixing bus. Chips on the bus are synthesized at clk/72 and their channel outputs, after the
+ * chips' own pan settings and the per-chip gain, are summed before a single rate converter shared by the bus.
+ * The sum is saturated to 16 bits before rate conversion; use gains below 1.0 for headroom.
+ * @param clk clock of the chips on the bus (a YMF262 joins at 4 times this clock).
+ * @param rate output sampling rate.
+ */
+OPL_BUS *OPL_BUS_new(uint32_t clk, uint32_t rate);
+
+/* chips on the bus are not deleted */
+void OPL_BUS_delete(OPL_BUS *bus);
+
+/**
+ * Add a chip to the bus. From then on the chip is rendered by the OPL_BUS_calc* functions only, and its
+ * own rate converter is released and no longer created. Native-rate ADPCM (OPL_setADPCMNativeRate) is turned off.
+ * Write queues, IRQ callbacks and timers of the chip keep working.
+ * @returns index of the chip on the bus, or -1 if the bus is full or the internal rate of the chip differs.
+ */
+int OPL_BUS_addChip(OPL_BUS *bus, OPL *opl);
+
+/* Set the output gain of a chip on the bus (1.0 by default). */
+void OPL_BUS_setGain(OPL_BUS *bus, uint32_t index, float left, float right);
+
+/* Calculate a stereo frame of the bus. */
+void OPL_BUS_calcStereo(OPL_BUS *bus, int32_t out[2]);
+
+/* Calculate interleaved stereo frames of the bus. */
+void OPL_BUS_calcStereoBlock(OPL_BUS *bus, int32_t *out, uint32_t samples);
 
 /* for compatibility */
 #define OPL_set_rate OPL_setRate
@@ -0,0 +1,471 @@
+/**
+ * C++ interface for emu8950 (C++17 or later, std::span overloads and the coroutine player with C++20).
+ */
+#ifndef _EMU8950_HPP_
+#define _EMU8950_HPP_
+
+#include "emu8950.h"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(__has_include)
+#if __has_include(<version>)
+#include <version>
+#endif
+#endif
+#if defined(__cpp_lib_span)
+#include <span>
+#endif
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine) && defined(__cpp_lib_span) &&                      \
+    defined(__cpp_concepts)
+#define EMU8950_HAS_COROUTINE 1
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#endif
+
+namespace opl {
+
+enum class ChipType : uint8_t { Y8950 = 0, YM3526 = 1, YM3812 = 2, YMF262 = 3 };
+
+/* register addresses. per-slot and per-channel registers are base addresses (see op() and ch()).
+ * bit 8 selects the second register bank of YMF262 and dual mode. */
+enum class Reg : uint16_t {
+  Test = 0x01,
+  Timer1 = 0x02,
+  Timer2 = 0x03,
+  Control = 0x04,
+  ADPCMControl = 0x07,
+  Misc = 0x08,
+  ADPCMStartL = 0x09,
+  ADPCMStartH = 0x0A,
+  ADPCMStopL = 0x0B,
+  ADPCMStopH = 0x0C,
+  ADPCMPrescaleL = 0x0D,
+  ADPCMPrescaleH = 0x0E,
+  ADPCMData = 0x0F,
+  ADPCMDeltaNL = 0x10,
+  ADPCMDeltaNH = 0x11,
+  ADPCMVolume = 0x12,
+  AmVibEgKsrMul = 0x20,
+  KslTl = 0x40,
+  ArDr = 0x60,
+  SlRr = 0x80,
+  FNumL = 0xA0,
+  KeyBlockFNumH = 0xB0,
+  Rhythm = 0xBD,
+  FbCon = 0xC0,
+  Waveform = 0xE0,
+};
+
+/* per-operator register at the given register offset (0x00-0x15, as laid out on the chip) in the given bank */
+constexpr Reg op(Reg base, unsigned offset, unsigned bank = 0) {
+  return static_cast<Reg>(static_cast<unsigned>(base) + offset + (bank << 8));
+}
+
+/* register of the given channel (0..8) in the given bank (1 for channels 9..17 of YMF262 and dual mode) */
+constexpr Reg ch(Reg base, unsigned channel, unsigned bank = 0) {
+  return static_cast<Reg>(static_cast<unsigned>(base) + channel + (bank << 8));
+}
+
+enum class EventType : uint8_t {
+  Timer1 = OPL_EVENT_TIMER1,
+  Timer2 = OPL_EVENT_TIMER2,
+  CSMKeyOn = OPL_EVENT_CSM_KEY_ON,
+  ADPCMEndOfSample = OPL_EVENT_ADPCM_EOS,
+  IRQOn = OPL_EVENT_IRQ_ON,
+  IRQOff = OPL_EVENT_IRQ_OFF,
+};
+
+/* layout-compatible with OPL_EVENT, so the C engine writes events directly into caller memory. */
+struct Event {
+  uint32_t offset; /* output frame index in the rendered block */
+  EventType type;
+};
+static_assert(sizeof(Event) == sizeof(OPL_EVENT), "Event must be layout-compatible with OPL_EVENT");
+static_assert(offsetof(Event, offset) == offsetof(OPL_EVENT, offset), "Event must be layout-compatible with OPL_EVENT");
+static_assert(offsetof(Event, type) == offsetof(OPL_EVENT, type), "Event must be layout-compatible with OPL_EVENT");
+
+/* register write at an output frame time (see OPL_queueWrite) */
+struct Write {
+  uint64_t time;
+  uint32_t reg;
+  uint8_t value;
+};
+
+namespace detail {
+
+template <typename T> struct is_sample : std::false_type {};
+template <> struct is_sample<int16_t> : std::true_type {};
+template <> struct is_sample<int32_t> : std::true_type {};
+template <> struct is_sample<float> : std::true_type {};
+
+template <typename T> inline T convert(int32_t v) {
+  if constexpr (std::is_same_v<T, float>) {
+    return static_cast<float>(v) * (1.0f / 32768.0f);
+  } else if constexpr (std::is_same_v<T, int16_t>) {
+    return static_cast<int16_t>(v < -32768 ? -32768 : (32767 < v ? 32767 : v));
+  } else {
+    return v;
+  }
+}
+
+/* frames per call into the C engine when the output needs conversion (sample type or planar layout) */
+constexpr std::size_t kChunk = 256;
+
+} // namespace detail
+
+/**
+ * Owning wrapper of an OPL instance. Movable, non-copyable.
+ * @tparam Type chip variant, fixed at compile time.
+ */
+template <ChipType Type = ChipType::Y8950> class Chip {
+public:
+  static constexpr ChipType type = Type;
+
+  explicit Chip(uint32_t clock = 3579545, uint32_t rate = 44100) : opl_(OPL_new(clock, rate)) {
+    if (opl_ == nullptr)
+      throw std::bad_alloc();
+    OPL_setChipType(opl_, static_cast<uint8_t>(Type));
+  }
+  ~Chip() {
+    if (opl_)
+      OPL_delete(opl_);
+  }
+  Chip(const Chip &) = delete;
+  Chip &operator=(const Chip &) = delete;
+  Chip(Chip &&other) noexcept : opl_(std::exchange(other.opl_, nullptr)), dropped_events_(other.dropped_events_) {}
+  Chip &operator=(Chip &&other) noexcept {
+    if (this != &other) {
+      if (opl_)
+        OPL_delete(opl_);
+      opl_ = std::exchange(other.opl_, nullptr);
+      dropped_events_ = other.dropped_events_;
+    }
+    return *this;
+  }
+
+  OPL *get() const noexcept { return opl_; }
+
+  void reset() {
+    OPL_reset(opl_);
+    OPL_setChipType(opl_, static_cast<uint8_t>(Type));
+  }
+  void setRate(uint32_t rate) { OPL_setRate(opl_, rate); }
+  void setPan(uint32_t channel, uint8_t pan) { OPL_setPan(opl_, channel, pan); }
+  uint32_t setMask(uint32_t mask) { return OPL_setMask(opl_, mask); }
+
+  /** Load an instrument into channel 0..8, or 0..17 on YMF262 and in dual mode (see OPL_setChannelPatch). */
+  void setChannelPatch(uint32_t channel, const OPL_PATCH (&mod_car)[2], uint8_t fb, uint8_t alg) {
+    OPL_setChannelPatch(opl_, channel, mod_car, fb, alg);
+  }
+
+  /** Run a second chip on registers 0x100-0x1FF, channels 9..17 (see OPL_setDualChip). Resets the chip. */
+  void setDualChip(bool enable) {
+    static_assert(Type == ChipType::YM3526 || Type == ChipType::YM3812, "dual mode is available on YM3526 and YM3812");
+    OPL_setDualChip(opl_, enable ? 1 : 0);
+  }
+
+  void write(Reg reg, uint8_t value) { OPL_writeReg(opl_, static_cast<uint32_t>(reg), value); }
+  void write(uint32_t reg, uint8_t value) { OPL_writeReg(opl_, reg, value); }
+  /** Schedule a write at output frame `time`. Throws std::bad_alloc if the queue cannot grow. */
+  void write(uint64_t time, Reg reg, uint8_t value) { queue(Write{time, static_cast<uint32_t>(reg), value}); }
+  void write(uint64_t time, uint32_t reg, uint8_t value) { queue(Write{time, reg, value}); }
+  void queue(const Write &w) {
+    if (!OPL_queueWrite(opl_, w.time, w.reg, w.value))
+      throw std::bad_alloc();
+  }
+  /* output frames rendered since reset, i.e. the time of the next frame */
+  uint64_t time() const noexcept { return opl_->sample_count; }
+  std::size_t pendingWrites() const noexcept { return opl_->queue_len; }
+
+  uint8_t status() const { return OPL_status(opl_); }
+  uint32_t nextEventCycles() const { return OPL_nextEventCycles(opl_); }
+  /* events the last render call could not store because `max_events` was reached */
+  std::size_t droppedEvents() const noexcept { return dropped_events_; }
+
+  /* returns false if memory for the data could not be allocated */
+  bool writeADPCMData(uint32_t start, const uint8_t *data, uint32_t length, bool rom = false) {
+    static_assert(Type == ChipType::Y8950, "ADPCM is only available on Y8950");
+    return OPL_writeADPCMData(opl_, rom ? 1 : 0, start, length, data) != 0;
+  }
+
+  /**
+   * Render interleaved stereo frames into caller memory. int32_t frames are rendered in place; other sample
+   * types are converted from a bounce buffer of detail::kChunk frames.
+   * @returns number of events stored to `events`.
+   */
+  template <typename T>
+  std::size_t render(T *interleaved, std::size_t frames, Event *events = nullptr, std::size_t max_events = 0) {
+    static_assert(detail::is_sample<T>::value, "sample type must be int16_t, int32_t or float");
+    if constexpr (std::is_same_v<T, int32_t>) {
+      const std::size_t count =
+          OPL_calcStereoBlock(opl_, interleaved, static_cast<uint32_t>(frames), reinterpret_cast<OPL_EVENT *>(events),
+                              static_cast<uint32_t>(events ? max_events : 0));
+      dropped_events_ = OPL_droppedEvents(opl_);
+      return count;
+    } else {
+      return renderStereo(frames, events, max_events, [&](std::size_t i, int32_t l, int32_t r) {
+        interleaved[i * 2] = detail::convert<T>(l);
+        interleaved[i * 2 + 1] = detail::convert<T>(r);
+      });
+    }
+  }
+
+  /** Render planar stereo frames into caller memory. */
+  template <typename T>
+  std::size_t render(T *left, T *right, std::size_t frames, Event *events = nullptr, std::size_t max_events = 0) {
+    static_assert(detail::is_sample<T>::value, "sample type must be int16_t, int32_t or float");
+    return renderStereo(frames, events, max_events, [&](std::size_t i, int32_t l, int32_t r) {
+      left[i] = detail::convert<T>(l);
+      right[i] = detail::convert<T>(r);
+    });
+  }
+
+  /** Render mono samples into caller memory. */
+  template <typename T>
+  std::size_t renderMono(T *out, std::size_t samples, Event *events = nullptr, std::size_t max_events = 0) {
+    static_assert(detail::is_sample<T>::value, "sample type must be int16_t, int32_t or float");
+    if constexpr (std::is_same_v<T, int16_t>) {
+      const std::size_t count = OPL_calcBlock(opl_, out, static_cast<uint32_t>(samples),
+                                              reinterpret_cast<OPL_EVENT *>(events), static_cast<uint32_t>(max_events));
+      dropped_events_ = OPL_droppedEvents(opl_);
+      return count;
+    } else {
+      int16_t buf[detail::kChunk];
+      std::size_t pos = 0, count = 0;
+      dropped_events_ = 0;
+      while (pos < samples) {
+        const std::size_t n = samples - pos < detail::kChunk ? samples - pos : detail::kChunk;
+        const std::size_t c = OPL_calcBlock(opl_, buf, static_cast<uint32_t>(n), chunkEvents(events, count),
+                                            static_cast<uint32_t>(max_events - count));
+        dropped_events_ += OPL_droppedEvents(opl_);
+        shiftEvents(events, count, c, pos);
+        count += c;
+        for (std::size_t i = 0; i < n; i++)
+          out[pos + i] = detail::convert<T>(buf[i]);
+        pos += n;
+      }
+      return count;
+    }
+  }
+
+#if defined(__cpp_lib_span)
+  template <typename T> std::size_t render(std::span<T> interleaved, std::span<Event> events = {}) {
+    return render(interleaved.data(), interleaved.size() / 2, events.data(), events.size());
+  }
+  template <typename T> std::size_t render(std::span<T> left, std::span<T> right, std::span<Event> events = {}) {
+    return render(left.data(), right.data(), left.size() < right.size() ? left.size() : right.size(), events.data(),
+                  events.size());
+  }
+  template <typename T> std::size_t renderMono(std::span<T> out, std::span<Event> events = {}) {
+    return renderMono(out.data(), out.size(), events.data(), events.size());
+  }
+#endif
+
+private:
+  OPL *opl_;
+  std::size_t dropped_events_ = 0;
+
+  static OPL_EVENT *chunkEvents(Event *events, std::size_t count) {
+    return events ? reinterpret_cast<OPL_EVENT *>(events + count) : nullptr;
+  }
+
+  static void shiftEvents(Event *events, std::size_t from, std::size_t count, std::size_t offset) {
+    for (std::size_t i = 0; events && i < count; i++)
+      events[from + i].offset += static_cast<uint32_t>(offset);
+  }
+
+  template <typename Store>
+  std::size_t renderStereo(std::size_t frames, Event *events, std::size_t max_events, Store &&store) {
+    int32_t buf[detail::kChunk * 2];
+    std::size_t pos = 0, count = 0;
+    dropped_events_ = 0;
+    if (events == nullptr)
+      max_events = 0;
+    while (pos < frames) {
+      const std::size_t n = frames - pos < detail::kChunk ? frames - pos : detail::kChunk;
+      const std::size_t c = OPL_calcStereoBlock(opl_, buf, static_cast<uint32_t>(n), chunkEvents(events, count),
+                                                static_cast<uint32_t>(max_events - count));
+      dropped_events_ += OPL_droppedEvents(opl_);
+      shiftEvents(events, count, c, pos);
+      count += c;
+      for (std::size_t i = 0; i < n; i++)
+        store(pos + i, buf[i * 2], buf[i * 2 + 1]);
+      pos += n;
+    }
+    return count;
+  }
+};
+
+#if defined(EMU8950_HAS_COROUTINE)
+
+/**
+ * Asynchronous generator: a coroutine that may co_await and co_yield.
+ * The consumer awaits next(), which resumes the producer until its next co_yield (or end).
+ * Both sides are resumed by symmetric transfer, so no thread or executor is implied.
+ */
+template <typename T> class AsyncGenerator {
+public:
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct promise_type {
+    std::optional<T> value;
+    std::coroutine_handle<> consumer;
+    std::exception_ptr error;
+
+    AsyncGenerator get_return_object() noexcept { return AsyncGenerator(handle_type::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    auto final_suspend() noexcept {
+      value.reset();
+      return ToConsumer{};
+    }
+    auto yield_value(T v) noexcept {
+      value.emplace(std::move(v));
+      return ToConsumer{};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+  };
+
+  AsyncGenerator(AsyncGenerator &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  AsyncGenerator &operator=(AsyncGenerator &&other) noexcept {
+    if (this != &other) {
+      if (handle_)
+        handle_.destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  ~AsyncGenerator() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  /** co_await next() yields the next value, or std::nullopt once the producer has finished. */
+  auto next() noexcept {
+    struct Awaiter {
+      handle_type h;
+      bool await_ready() const noexcept { return !h || h.done(); }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept {
+        h.promise().consumer = consumer;
+        return h;
+      }
+      std::optional<T> await_resume() {
+        if (!h)
+          return std::nullopt;
+        if (h.promise().error)
+          std::rethrow_exception(std::exchange(h.promise().error, nullptr));
+        return std::exchange(h.promise().value, std::nullopt);
+      }
+    };
+    return Awaiter{handle_};
+  }
+
+private:
+  handle_type handle_;
+
+  explicit AsyncGenerator(handle_type h) noexcept : handle_(h) {}
+
+  struct ToConsumer {
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(handle_type h) noexcept {
+      auto c = h.promise().consumer;
+      return c ? c : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+  };
+};
+
+template <typename A> concept Awaitable = requires(A a) {
+  a.await_ready();
+  a.await_resume();
+} || requires(A a) {
+  a.operator co_await();
+};
+
+/**
+ * Source of register writes in non-decreasing time order.
+ * co_await next() produces the next write, or std::nullopt at the end of the stream.
+ */
+template <typename S> concept WriteSource = requires(S &s) {
+  { s.next() } -> Awaitable;
+};
+
+/**
+ * Ring buffer the player renders into, in interleaved stereo samples of type T.
+ * - acquire(n): contiguous writable region of at most n samples; empty if the ring is full.
+ * - commit(n): publish n samples of the last acquired region to the reader.
+ * - writable(): awaitable that resumes the player once acquire() may return a non-empty region.
+ */
+template <typename S, typename T> concept BlockSink = requires(S &s, std::size_t n) {
+  { s.acquire(n) } -> std::convertible_to<std::span<T>>;
+  s.commit(n);
+  { s.writable() } -> Awaitable;
+};
+
+/* a rendered block, living in the sink's memory until the player is resumed */
+template <typename T> struct Block {
+  uint64_t time;                  /* output frame time of the first frame */
+  std::span<T> samples;           /* interleaved stereo */
+  std::span<const Event> events;  /* offsets relative to the first frame */
+  std::size_t dropped_events;     /* events beyond the capacity of `events` (64), lost */
+};
+
+/**
+ * Streaming player: pulls writes from `source` up to the end of each block, queues them on the chip,
+ * renders into memory acquired from `sink` (in place for int32_t, see Chip::render), co_yields the block, then
+ * commits it when resumed.
+ * It suspends on the sink while the ring is full and on the source while writes are pending, so many players
+ * can be driven by one executor. The stream ends when the source is exhausted and all writes have been applied.
+ * `chip`, `source` and `sink` must outlive the generator.
+ * @param frames maximum number of frames per block.
+ */
+template <typename T, ChipType Type, WriteSource Source, BlockSink<T> Sink>
+AsyncGenerator<Block<T>> play(Chip<Type> &chip, Source &source, Sink &sink, std::size_t frames = detail::kChunk) {
+  static_assert(detail::is_sample<T>::value, "sample type must be int16_t, int32_t or float");
+  Event events[64];
+  std::optional<Write> pending;
+  bool more = true;
+
+  for (;;) {
+    const uint64_t end = chip.time() + frames;
+    while (more || pending) {
+      if (!pending) {
+        pending = co_await source.next();
+        if (!pending) {
+          more = false;
+          break;
+        }
+      }
+      if (pending->time >= end)
+        break;
+      chip.queue(*pending);
+      pending.reset();
+    }
+    if (!pending && !more && chip.pendingWrites() == 0)
+      break;
+
+    std::span<T> region = sink.acquire(frames * 2);
+    while (region.size() < 2) {
+      co_await sink.writable();
+      region = sink.acquire(frames * 2);
+    }
+    const uint64_t time = chip.time();
+    const std::size_t n = region.size() / 2;
+    const std::size_t count = chip.render(region.data(), n, events, sizeof(events) / sizeof(events[0]));
+    co_yield Block<T>{time, region.first(n * 2), std::span<const Event>(events, count), chip.droppedEvents()};
+    sink.commit(n * 2);
+  }
+}
+
+#endif
+
+} // namespace opl
+
+#endif
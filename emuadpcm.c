@@ -6,6 +6,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+static SRWLOCK pool_lock = SRWLOCK_INIT;
+#define POOL_LOCK() AcquireSRWLockExclusive(&pool_lock)
+#define POOL_UNLOCK() ReleaseSRWLockExclusive(&pool_lock)
+#else
+#include <pthread.h>
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#define POOL_LOCK() pthread_mutex_lock(&pool_lock)
+#define POOL_UNLOCK() pthread_mutex_unlock(&pool_lock)
+#endif
+
 #define DMAX 0x5FFF
 #define DMIN 0x7F
 #define DDEF 0x7F
@@ -13,6 +27,7 @@
 #define DECODE_MAX 32767
 #define DECODE_MIN (-32768)
 
+#define min(i, j) (((i) < (j)) ? (i) : (j))
 #define CLAP(min, x, max) ((x < min) ? min : (max < x) ? max : x)
 
 /* Bitmask for register $07 */
@@ -39,28 +54,194 @@
 #define RAM_SIZE (256 * 1024)
 #define ROM_SIZE (256 * 1024)
 
+#define PAGE_SIZE (1 << OPL_ADPCM_PAGE_BITS)
+#define PAGE_MASK (PAGE_SIZE - 1)
+#define POOL_BUCKETS 256
+
 FILE *fp;
 
+static inline void invalidate_cache(OPL_ADPCM *_this) { _this->cache_pos = _this->cache_len = 0; }
+
+/***************************************************
+
+           Copy-on-write pages of ADPCM memory
+
+****************************************************/
+/* Pages uploaded by OPL_ADPCM_writeRAM/ROM are registered in a process-wide pool keyed by their content,
+ * so identical uploads on any instance share the same page. Pooled pages are never modified: a page is
+ * copied before it is written through register $0F, and such private pages stay out of the pool.
+ * pool_lock guards the pool and the reference counts; the content of a private page is only touched by the
+ * instance that owns it (see OPL_ADPCM.private_page) and needs no lock. */
+struct __OPL_ADPCM_PAGE {
+  uint32_t ref;
+  uint32_t hash;
+  uint8_t pooled;
+  struct __OPL_ADPCM_PAGE *next;
+  uint8_t data[PAGE_SIZE];
+};
+
+static OPL_ADPCM_PAGE *page_pool[POOL_BUCKETS];
+
+static uint32_t page_hash(const uint8_t *data) {
+  uint32_t h = 2166136261u;
+  int i;
+  for (i = 0; i < PAGE_SIZE; i++) {
+    h = (h ^ data[i]) * 16777619u;
+  }
+  return h;
+}
+
+/* get a pooled page with the given content. */
+static OPL_ADPCM_PAGE *page_acquire(const uint8_t *data) {
+  const uint32_t hash = page_hash(data);
+  OPL_ADPCM_PAGE **bucket = &page_pool[hash & (POOL_BUCKETS - 1)];
+  OPL_ADPCM_PAGE *page;
+
+  POOL_LOCK();
+  for (page = *bucket; page != NULL; page = page->next) {
+    if (page->hash == hash && memcmp(page->data, data, PAGE_SIZE) == 0) {
+      page->ref++;
+      POOL_UNLOCK();
+      return page;
+    }
+  }
+
+  page = (OPL_ADPCM_PAGE *)malloc(sizeof(OPL_ADPCM_PAGE));
+  if (page) {
+    page->ref = 1;
+    page->hash = hash;
+    page->pooled = 1;
+    memcpy(page->data, data, PAGE_SIZE);
+    page->next = *bucket;
+    *bucket = page;
+  }
+  POOL_UNLOCK();
+  return page;
+}
+
+/* called with pool_lock held */
+static void page_unlink(OPL_ADPCM_PAGE *page) {
+  OPL_ADPCM_PAGE **p = &page_pool[page->hash & (POOL_BUCKETS - 1)];
+  while (*p != page) {
+    p = &(*p)->next;
+  }
+  *p = page->next;
+  page->pooled = 0;
+}
+
+static void page_release(OPL_ADPCM_PAGE *page) {
+  uint32_t ref;
+
+  if (!page)
+    return;
+
+  POOL_LOCK();
+  ref = --page->ref;
+  if (ref == 0 && page->pooled)
+    page_unlink(page);
+  POOL_UNLOCK();
+
+  if (ref == 0)
+    free(page);
+}
+
+/* make the page at *slot writable by this instance only. returns NULL if no memory is available. */
+static uint8_t *page_make_private(OPL_ADPCM_PAGE **slot) {
+  OPL_ADPCM_PAGE *page = *slot;
+
+  POOL_LOCK();
+  if (page->ref == 1) {
+    if (page->pooled)
+      page_unlink(page);
+    POOL_UNLOCK();
+    return page->data;
+  }
+  POOL_UNLOCK();
+
+  /* the content of a shared page is immutable, so it can be copied without the lock */
+  page = (OPL_ADPCM_PAGE *)malloc(sizeof(OPL_ADPCM_PAGE));
+  if (!page)
+    return NULL;
+  page->ref = 1;
+  page->pooled = 0;
+  memcpy(page->data, (*slot)->data, PAGE_SIZE);
+  page_release(*slot);
+  *slot = page;
+  return page->data;
+}
+
+static inline uint8_t read_byte(OPL_ADPCM_PAGE *const *bank, uint32_t addr) {
+  return bank[addr >> OPL_ADPCM_PAGE_BITS]->data[addr & PAGE_MASK];
+}
+
+/* page holding byte addr of memory b (0:RAM 1:ROM), writable without the lock. NULL if no memory. */
+static uint8_t *private_page(OPL_ADPCM *_this, int b, uint32_t addr) {
+  const uint32_t n = addr >> OPL_ADPCM_PAGE_BITS;
+  if (!_this->private_page[b][n]) {
+    if (!page_make_private(&_this->memory[b][n]))
+      return NULL;
+    _this->private_page[b][n] = 1;
+  }
+  return _this->memory[b][n]->data;
+}
+
+static inline int wave_bank(OPL_ADPCM *_this) { return _this->wave == _this->memory[1]; }
+
+/* upload data to memory b. Private pages are written in place; other pages are replaced by a pooled page
+ * with the resulting content. returns 0 if a page could not be allocated (its part of data is not stored). */
+static uint8_t upload(OPL_ADPCM *_this, int b, uint32_t start, uint32_t length, const uint8_t *data) {
+  uint8_t buf[PAGE_SIZE];
+  uint8_t ok = 1;
+
+  while (length > 0) {
+    const uint32_t n = start >> OPL_ADPCM_PAGE_BITS;
+    const uint32_t offset = start & PAGE_MASK;
+    const uint32_t run = min(length, PAGE_SIZE - offset);
+    OPL_ADPCM_PAGE **slot = &_this->memory[b][n];
+
+    if (_this->private_page[b][n] && run < PAGE_SIZE) {
+      memcpy((*slot)->data + offset, data, run);
+    } else {
+      OPL_ADPCM_PAGE *page;
+      if (run < PAGE_SIZE) {
+        memcpy(buf, (*slot)->data, PAGE_SIZE);
+        memcpy(buf + offset, data, run);
+      }
+      page = page_acquire(run < PAGE_SIZE ? buf : data);
+      if (page) {
+        page_release(*slot);
+        *slot = page;
+        _this->private_page[b][n] = 0;
+      } else {
+        ok = 0;
+      }
+    }
+
+    start += run;
+    data += run;
+    length -= run;
+  }
+  return ok;
+}
+
 OPL_ADPCM *OPL_ADPCM_new(uint32_t clk) {
+  static const uint8_t zero[PAGE_SIZE];
   OPL_ADPCM *_this;
+  int i;
 
-  _this = (OPL_ADPCM *)malloc(sizeof(OPL_ADPCM));
+  _this = (OPL_ADPCM *)calloc(1, sizeof(OPL_ADPCM));
   if (!_this)
     return NULL;
 
   _this->clk = clk;
 
-  /* 256Kbytes RAM */
-  _this->memory[0] = (uint8_t *)malloc(RAM_SIZE);
-  if (!_this->memory[0])
-    goto Error_Exit;
-  memset(_this->memory[0], 0, RAM_SIZE);
-
-  /* 256Kbytes ROM */
-  _this->memory[1] = (uint8_t *)malloc(ROM_SIZE);
-  if (!_this->memory[1])
-    goto Error_Exit;
-  memset(_this->memory[1], 0, ROM_SIZE);
+  /* 256Kbytes RAM and 256Kbytes ROM, initially sharing one zero-filled page */
+  for (i = 0; i < OPL_ADPCM_PAGE_COUNT; i++) {
+    _this->memory[0][i] = page_acquire(zero);
+    _this->memory[1][i] = page_acquire(zero);
+    if (!_this->memory[0][i] || !_this->memory[1][i])
+      goto Error_Exit;
+  }
 
   OPL_ADPCM_reset(_this);
 
@@ -72,9 +253,12 @@ Error_Exit:
 }
 
 void OPL_ADPCM_delete(OPL_ADPCM *_this) {
+  int i;
   if (_this) {
-    free(_this->memory[0]);
-    free(_this->memory[1]);
+    for (i = 0; i < OPL_ADPCM_PAGE_COUNT; i++) {
+      page_release(_this->memory[0][i]);
+      page_release(_this->memory[1][i]);
+    }
     free(_this);
   }
 }
@@ -95,63 +279,98 @@ void OPL_ADPCM_reset(OPL_ADPCM *_this) {
   _this->wave = _this->memory[0];
   _this->play_addr_mask = _this->reg[0x08] & R08_64K ? (1 << 17) - 1 : (1 << 19) - 1;
   _this->output[0] = _this->output[1] = 0;
+  _this->mem_error = 0;
+  invalidate_cache(_this);
 }
 
 #define DELTA_ADDR_MAX (1 << 16)
 #define DELTA_ADDR_MASK (DELTA_ADDR_MAX - 1)
 
-/* Update OPL_ADPCM data stage (Register $0F) */
-static inline int update_stage(OPL_ADPCM *_this) {
-  _this->delta_addr += _this->delta_n;
+static inline void decode_nibble(int32_t *output, uint32_t *diff, uint32_t val) {
+  static uint32_t F[] = {
+      57, 57, 57, 57, 77, 102, 128, 153 // This table values are from ymdelta.c by Tatsuyuki Satoh.
+  };
+
+  int32_t out = *output;
 
-  if (_this->delta_addr & DELTA_ADDR_MAX) {
-    _this->delta_addr &= DELTA_ADDR_MASK;
-    _this->play_addr = (_this->play_addr + 1) & (_this->play_addr_mask);
+  if (val & 8)
+    out -= (*diff * ((val & 7) * 2 + 1)) >> 3;
+  else
+    out += (*diff * ((val & 7) * 2 + 1)) >> 3;
+
+  *output = CLAP(DECODE_MIN, out, DECODE_MAX);
+  *diff = CLAP(DMIN, (*diff * F[val & 7]) >> 6, DMAX);
+}
 
-    if (_this->play_addr == (_this->stop_addr & _this->play_addr_mask)) {
-      if (_this->reg[0x07] & R07_REPEAT) {
-        _this->play_addr = _this->start_addr & (_this->play_addr_mask);
+/* Decode nibbles ahead of the play position, starting from the current playback state. */
+static void decode_ahead(OPL_ADPCM *_this) {
+  const uint32_t mask = _this->play_addr_mask;
+  const uint32_t stop_addr = _this->stop_addr & mask;
+  const uint32_t start_addr = _this->start_addr & mask;
+  const uint8_t repeat = _this->reg[0x07] & R07_REPEAT;
+  uint32_t addr = _this->play_addr;
+  uint8_t data = _this->reg[0x0F];
+  int32_t output = _this->output[0];
+  uint32_t diff = _this->diff;
+  uint8_t eos = 0;
+  int i;
+
+  for (i = 0; i < OPL_ADPCM_CACHE_SIZE && !eos; i++) {
+    OPL_ADPCM_STEP *step = &_this->cache[i];
+
+    addr = (addr + 1) & mask;
+    if (addr == stop_addr) {
+      if (repeat) {
+        addr = start_addr;
       } else {
-        _this->play_start = 0;
-        _this->status &= ~STATUS_PCM_BSY;
-        _this->status |= STATUS_EOS;
+        eos = 1;
       }
     } else {
-      _this->reg[0x0F] = _this->wave[_this->play_addr >> 1];
+      data = read_byte(_this->wave, addr >> 1);
     }
 
-    return 1;
+    decode_nibble(&output, &diff, (addr & 1) ? (data & 0x0F) : (data >> 4));
+
+    step->output = output;
+    step->diff = diff;
+    step->play_addr = addr;
+    step->data = data;
+    step->eos = eos;
   }
 
-  return 0;
+  _this->cache_pos = 0;
+  _this->cache_len = i;
 }
 
-static inline void update_output(OPL_ADPCM *_this, uint32_t val) {
-  static uint32_t F[] = {
-      57, 57, 57, 57, 77, 102, 128, 153 // This table values are from ymdelta.c by Tatsuyuki Satoh.
-  };
-
-  _this->output[1] = _this->output[0];
+/* Advance the play position by one nibble using the decode-ahead cache. */
+static inline void update_stage(OPL_ADPCM *_this) {
+  const OPL_ADPCM_STEP *step;
 
-  if (val & 8)
-    _this->output[0] -= (_this->diff * ((val & 7) * 2 + 1)) >> 3;
-  else
-    _this->output[0] += (_this->diff * ((val & 7) * 2 + 1)) >> 3;
+  if (_this->cache_pos == _this->cache_len)
+    decode_ahead(_this);
 
-  _this->output[0] = CLAP(DECODE_MIN, _this->output[0], DECODE_MAX);
-  _this->diff = CLAP(DMIN, (_this->diff * F[val & 7]) >> 6, DMAX);
+  step = &_this->cache[_this->cache_pos++];
+  _this->play_addr = step->play_addr;
+  _this->reg[0x0F] = step->data;
+  _this->output[1] = _this->output[0];
+  _this->output[0] = step->output;
+  _this->diff = step->diff;
+
+  if (step->eos) {
+    _this->play_start = 0;
+    _this->status &= ~STATUS_PCM_BSY;
+    _this->status |= STATUS_EOS;
+    invalidate_cache(_this);
+  }
 }
 
 static inline uint32_t calc(OPL_ADPCM *_this) {
-  uint32_t val;
-
-  if (_this->play_start && update_stage(_this)) {
-    if (_this->play_addr & 1)
-      val = _this->reg[0x0F] & 0x0F;
-    else
-      val = _this->reg[0x0F] >> 4;
-
-    update_output(_this, val);
+  if (_this->play_start) {
+    _this->delta_addr += _this->delta_n;
+    if (_this->delta_addr & DELTA_ADDR_MAX) {
+      _this->delta_addr &= DELTA_ADDR_MASK;
+      update_stage(_this);
+    }
   }
 
   return ((_this->output[0] + _this->output[1]) * (_this->reg[0x12] & 0xff)) >> 13;
@@ -164,6 +383,79 @@ int16_t OPL_ADPCM_calc(OPL_ADPCM *_this) {
   return calc(_this);
 }
 
+uint32_t OPL_ADPCM_calcNative(OPL_ADPCM *_this, uint32_t steps, int16_t *out) {
+  const uint32_t total = _this->delta_addr + steps * _this->delta_n;
+  const uint32_t count = total >> 16;
+  uint32_t i;
+
+  /* as in calc(), the position only moves while playing */
+  if (!_this->play_start)
+    return 0;
+
+  _this->delta_addr = total & DELTA_ADDR_MASK;
+
+  for (i = 0; i < count; i++) {
+    if (_this->reg[0x07] & R07_SP_OFF) {
+      out[i] = 0;
+      continue;
+    }
+    if (_this->play_start) {
+      update_stage(_this);
+    }
+    out[i] = ((_this->output[0] + _this->output[1]) * (_this->reg[0x12] & 0xff)) >> 13;
+  }
+
+  return count;
+}
+
+int OPL_ADPCM_getConstantOutput(OPL_ADPCM *_this, int16_t *out) {
+  if (_this->reg[0x07] & R07_SP_OFF) {
+    *out = 0;
+    return 1;
+  }
+  if (!_this->play_start || _this->delta_n == 0) {
+    *out = ((_this->output[0] + _this->output[1]) * (_this->reg[0x12] & 0xff)) >> 13;
+    return 1;
+  }
+  return 0;
+}
+
+/* The playback unit steps the nibble address before decoding, so a sample starting at byte n plays from the
+ * low nibble of byte n. Sample i is therefore stored at nibble i + 1, behind an unplayed pad nibble. */
+void OPL_ADPCM_encode(const int16_t *pcm, uint32_t samples, uint8_t *adpcm) {
+  int32_t output = 0;
+  uint32_t diff = DDEF;
+  uint32_t i;
+
+  adpcm[0] = 0;
+  for (i = 0; i < samples; i++) {
+    const int32_t d = pcm[i] - output;
+    const uint32_t mag = d < 0 ? -d : d;
+    /* the decoder adds diff*(2n+1)/8, so the nearest n is floor(mag*4/diff) */
+    const uint32_t n = (mag << 2) / diff;
+    const uint32_t val = (d < 0 ? 8 : 0) | (n < 7 ? n : 7);
+
+    decode_nibble(&output, &diff, val);
+
+    if (i & 1)
+      adpcm[(i + 1) >> 1] = val << 4;
+    else
+      adpcm[(i + 1) >> 1] |= val;
+  }
+}
+
+void OPL_ADPCM_decode(const uint8_t *adpcm, uint32_t samples, int16_t *pcm) {
+  int32_t output = 0;
+  uint32_t diff = DDEF;
+  uint32_t i;
+
+  for (i = 0; i < samples; i++) {
+    const uint8_t data = adpcm[(i + 1) >> 1];
+    decode_nibble(&output, &diff, (i & 1) ? (data >> 4) : (data & 0x0F));
+    pcm[i] = output;
+  }
+}
+
 /* mode= 0:RAM256k 1:ROM 2:RAM64k */
 uint32_t decode_start_address(uint8_t mode, uint8_t l, uint8_t h) {
   switch (mode) {
@@ -187,6 +479,11 @@ void OPL_ADPCM_writeReg(OPL_ADPCM *_this, uint32_t adr, uint32_t data) {
   adr &= 0x1f;
   data &= 0xff;
 
+  /* DELTA-N and ENVELOP CONTROL do not change the decoded sequence */
+  if (adr < 0x10) {
+    invalidate_cache(_this);
+  }
+
   switch (adr) {
   case 0x07: /* START/REC/MEM DATA/REPEAT/SP-OFF/RESET */
     if (data & R07_RESET) {
@@ -235,7 +532,11 @@ void OPL_ADPCM_writeReg(OPL_ADPCM *_this, uint32_t adr, uint32_t data) {
     _this->reg[0x0F] = data;
 
     if ((_this->reg[0x07] & R07_REC) && (_this->reg[0x07] & R07_MEMORY_DATA)) {
-      _this->wave[_this->play_addr >> 1] = data;
+      uint8_t *p = private_page(_this, wave_bank(_this), _this->play_addr >> 1);
+      if (p)
+        p[(_this->play_addr >> 1) & PAGE_MASK] = data;
+      else
+        _this->mem_error = 1;
       _this->play_addr = (_this->play_addr + 2) & (_this->play_addr_mask);
       if (_this->play_addr >= (_this->stop_addr & _this->play_addr_mask)) {
         //_this->status |= STATUS_EOS; /* Bug? */
@@ -258,6 +559,45 @@ void OPL_ADPCM_writeReg(OPL_ADPCM *_this, uint32_t adr, uint32_t data) {
   }
 }
 
+/* A $0F write outside recording only changes the latch. Decoding ahead reads the latch only when the next
+ * nibble is at the stop address, so the cache stays valid otherwise. */
+static inline void invalidate_on_latch(OPL_ADPCM *_this) {
+  const uint32_t mask = _this->play_addr_mask;
+  if (((_this->play_addr + 1) & mask) == (_this->stop_addr & mask))
+    invalidate_cache(_this);
+}
+
+uint8_t OPL_ADPCM_writeMemoryData(OPL_ADPCM *_this, const uint8_t *data, uint32_t length) {
+  const uint32_t mem_size = (_this->play_addr_mask >> 1) + 1;
+  uint8_t ok = 1;
+
+  if (length == 0)
+    return 1;
+
+  _this->reg[0x0F] = data[length - 1];
+
+  if ((_this->reg[0x07] & R07_REC) && (_this->reg[0x07] & R07_MEMORY_DATA)) {
+    invalidate_cache(_this); /* the write pointer is the play position */
+    while (length > 0) {
+      const uint32_t addr = _this->play_addr >> 1;
+      const uint32_t run = min(length, min(mem_size - addr, PAGE_SIZE - (addr & PAGE_MASK)));
+      uint8_t *p = private_page(_this, wave_bank(_this), addr);
+      if (p)
+        memcpy(p + (addr & PAGE_MASK), data, run);
+      else
+        ok = 0;
+      _this->play_addr = (_this->play_addr + run * 2) & _this->play_addr_mask;
+      data += run;
+      length -= run;
+    }
+  } else {
+    invalidate_on_latch(_this);
+  }
+  if (!ok)
+    _this->mem_error = 1;
+  return ok;
+}
+
 /**
  * 76543210
  *    ||  +- D0: PCM-BSY
@@ -270,22 +610,64 @@ uint8_t OPL_ADPCM_status(OPL_ADPCM *_this) {
   return _this->status | STATUS_BUF_RDY;
 }
 
+/**
+ * Number of calc() steps until the playback reaches the stop address and raises EOS.
+ * Returns 0xFFFFFFFF if no EOS is expected (idle, repeat, SP-OFF or zero delta-n).
+ */
+uint32_t OPL_ADPCM_nextEventSteps(OPL_ADPCM *_this) {
+  uint64_t nibbles, steps;
+
+  if (!_this->play_start || (_this->reg[0x07] & (R07_REPEAT | R07_SP_OFF)) || _this->delta_n == 0)
+    return 0xFFFFFFFF;
+
+  nibbles = ((_this->stop_addr & _this->play_addr_mask) - _this->play_addr) & _this->play_addr_mask;
+  if (nibbles == 0)
+    nibbles = (uint64_t)_this->play_addr_mask + 1;
+
+  steps = (nibbles * DELTA_ADDR_MAX - _this->delta_addr + _this->delta_n - 1) / _this->delta_n;
+  return steps < 0xFFFFFFFF ? (uint32_t)steps : 0xFFFFFFFF;
+}
+
 void OPL_ADPCM_resetStatus(OPL_ADPCM *_this) {
   _this->status = 0;
 }
 
-void OPL_ADPCM_writeRAM(OPL_ADPCM *_this, uint32_t start, uint32_t length, const uint8_t *data) {
-  if (start >= RAM_SIZE) return;
+uint8_t OPL_ADPCM_memoryError(OPL_ADPCM *_this) {
+  const uint8_t ret = _this->mem_error;
+  _this->mem_error = 0;
+  return ret;
+}
+
+/* Drop decoded-ahead nibbles if a memory write overlaps the play range. */
+static void invalidate_on_overlap(OPL_ADPCM *_this, uint32_t start, uint32_t length) {
+  const uint32_t play_start = (_this->start_addr & _this->play_addr_mask) >> 1;
+  const uint32_t play_stop = (_this->stop_addr & _this->play_addr_mask) >> 1;
+
+  if (play_stop < play_start || (start <= play_stop && play_start < start + length)) {
+    invalidate_cache(_this);
+  }
+}
+
+uint8_t OPL_ADPCM_writeRAM(OPL_ADPCM *_this, uint32_t start, uint32_t length, const uint8_t *data) {
+  uint8_t ok;
+  if (start >= RAM_SIZE) return 1;
   if (start + length > RAM_SIZE) {
     length = RAM_SIZE - start;
   }
-  memcpy(_this->memory[0] + start, data, length);
+  ok = upload(_this, 0, start, length, data);
+  if (_this->wave == _this->memory[0])
+    invalidate_on_overlap(_this, start, length);
+  return ok;
 }
 
-void OPL_ADPCM_writeROM(OPL_ADPCM *_this, uint32_t start, uint32_t length, const uint8_t *data) {
-  if (start >= ROM_SIZE) return;
+uint8_t OPL_ADPCM_writeROM(OPL_ADPCM *_this, uint32_t start, uint32_t length, const uint8_t *data) {
+  uint8_t ok;
+  if (start >= ROM_SIZE) return 1;
   if (start + length > ROM_SIZE) {
     length = ROM_SIZE - start;
   }
-  memcpy(_this->memory[1] + start, data, length);
+  ok = upload(_this, 1, start, length, data);
+  if (_this->wave == _this->memory[1])
+    invalidate_on_overlap(_this, start, length);
+  return ok;
 }
\ No newline at end of file
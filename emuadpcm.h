@@ -3,13 +3,36 @@
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* number of nibbles decoded ahead of the play position */
+#define OPL_ADPCM_CACHE_SIZE 64
+
+/* ADPCM memory is managed in reference-counted copy-on-write pages */
+#define OPL_ADPCM_PAGE_BITS 12
+#define OPL_ADPCM_PAGE_COUNT ((256 * 1024) >> OPL_ADPCM_PAGE_BITS)
+
+typedef struct __OPL_ADPCM_PAGE OPL_ADPCM_PAGE;
+
+typedef struct __OPL_ADPCM_STEP {
+  int32_t output;
+  uint32_t diff;
+  uint32_t play_addr;
+  uint8_t data;
+  uint8_t eos;
+} OPL_ADPCM_STEP;
+
 typedef struct __OPL_ADPCM {
   uint32_t clk;
 
   uint8_t reg[0x20];
 
-  uint8_t *wave;      /* ADPCM DATA */
-  uint8_t *memory[2]; /* [0] RAM, [1] ROM */
+  OPL_ADPCM_PAGE **wave;                            /* ADPCM DATA */
+  OPL_ADPCM_PAGE *memory[2][OPL_ADPCM_PAGE_COUNT]; /* [0] RAM, [1] ROM */
+  uint8_t private_page[2][OPL_ADPCM_PAGE_COUNT];   /* 1 if the page is owned by this instance only */
+  uint8_t mem_error; /* set when a memory write was dropped because a page could not be allocated, until read */
 
   uint8_t status;
 
@@ -25,6 +48,10 @@ typedef struct __OPL_ADPCM {
   int32_t output[2];
   uint32_t diff;
 
+  OPL_ADPCM_STEP cache[OPL_ADPCM_CACHE_SIZE];
+  uint32_t cache_pos;
+  uint32_t cache_len;
+
 } OPL_ADPCM;
 
 OPL_ADPCM *OPL_ADPCM_new(uint32_t clk);
@@ -32,8 +59,57 @@ void OPL_ADPCM_reset(OPL_ADPCM *);
 void OPL_ADPCM_delete(OPL_ADPCM *);
 void OPL_ADPCM_writeReg(OPL_ADPCM *, uint32_t reg, uint32_t val);
 int16_t OPL_ADPCM_calc(OPL_ADPCM *);
+/**
+ * Advance the unit by `steps` calc() periods and store one output sample per decoded nibble,
+ * i.e. at the native delta-N rate. `out` must have room for `steps` samples.
+ * Nothing is stored and the position does not move while the unit is not playing.
+ * @returns number of samples stored.
+ */
+uint32_t OPL_ADPCM_calcNative(OPL_ADPCM *, uint32_t steps, int16_t *out);
+/**
+ * Returns 1 if OPL_ADPCM_calc keeps returning the same value until the next register write,
+ * and stores that value to *out. Returns 0 while a sample is playing.
+ */
+int OPL_ADPCM_getConstantOutput(OPL_ADPCM *, int16_t *out);
+/**
+ * Same as writing each byte of data to register $0F in order, but memory-data writes
+ * (REC and MEMORY DATA set in register $07) are copied into the memory in runs.
+ * @returns 0 if some bytes were dropped because a page could not be allocated (see OPL_ADPCM_memoryError,
+ * which is the only report for single writes through OPL_ADPCM_writeReg).
+ */
+uint8_t OPL_ADPCM_writeMemoryData(OPL_ADPCM *, const uint8_t *data, uint32_t length);
 uint8_t OPL_ADPCM_status(OPL_ADPCM *);
 void OPL_ADPCM_resetStatus(OPL_ADPCM *);
-void OPL_ADPCM_writeRAM(OPL_ADPCM *, uint32_t start, uint32_t length, const uint8_t *data);
-void OPL_ADPCM_writeROM(OPL_ADPCM *, uint32_t start, uint32_t length, const uint8_t *data);
+/**
+ * Returns 1 if a memory write was dropped since the last call or OPL_ADPCM_reset, and clears the flag.
+ */
+uint8_t OPL_ADPCM_memoryError(OPL_ADPCM *);
+uint32_t OPL_ADPCM_nextEventSteps(OPL_ADPCM *);
+/**
+ * Encode PCM16 samples into Y8950 ADPCM nibbles in playback order.
+ * Playback from START address n begins at the low nibble of byte n, so the high nibble of adpcm[0] is an
+ * unplayed pad (0) and the samples follow from the low nibble of adpcm[0].
+ * The encoder tracks the exact decoder state, so OPL_ADPCM_decode reproduces its reconstruction bit by bit.
+ * No global state is used: independent samples of a bank can be encoded concurrently.
+ * @param adpcm buffer of samples / 2 + 1 bytes.
+ */
+void OPL_ADPCM_encode(const int16_t *pcm, uint32_t samples, uint8_t *adpcm);
+/**
+ * Decode Y8950 ADPCM nibbles with the same arithmetic and nibble order as the playback unit, i.e. the samples
+ * played from a START address pointing at adpcm[0] (see OPL_ADPCM_encode for the layout).
+ */
+void OPL_ADPCM_decode(const uint8_t *adpcm, uint32_t samples, int16_t *pcm);
+/**
+ * Upload ADPCM data. Pages with identical content are shared among all OPL_ADPCM instances through a
+ * process-wide pool guarded by a lock, so instances may be created, deleted and written on different threads
+ * (each instance itself is not thread-safe).
+ * @returns 0 if a page could not be allocated; the data of that page is not stored.
+ */
+uint8_t OPL_ADPCM_writeRAM(OPL_ADPCM *, uint32_t start, uint32_t length, const uint8_t *data);
+uint8_t OPL_ADPCM_writeROM(OPL_ADPCM *, uint32_t start, uint32_t length, const uint8_t *data);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,232 @@
+/**
+ * Instrument bank loaders for emu8950
+ */
+#include "emubank.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OP2_MELODIC 128
+#define OP2_COUNT 175
+#define OP2_FIRST_DRUM 35
+
+static uint16_t read16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t read32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+/* decode operator registers $20, $40, $60, $80 and $E0 */
+static void decode_op(OPL_PATCH *p, uint8_t r20, uint8_t r40, uint8_t r60, uint8_t r80, uint8_t rE0) {
+  p->AM = (r20 >> 7) & 1;
+  p->PM = (r20 >> 6) & 1;
+  p->EG = (r20 >> 5) & 1;
+  p->KR = (r20 >> 4) & 1;
+  p->ML = r20 & 15;
+  p->KL = (r40 >> 6) & 3;
+  p->TL = r40 & 63;
+  p->AR = (r60 >> 4) & 15;
+  p->DR = r60 & 15;
+  p->SL = (r80 >> 4) & 15;
+  p->RR = r80 & 15;
+  p->WS = rE0 & 3;
+  p->FB = 0;
+}
+
+static void decode_c0(OPL_MIDI_PATCH *patch, uint8_t rC0) {
+  patch->fb = (rC0 >> 1) & 7;
+  patch->alg = rC0 & 1;
+  patch->op[0].FB = patch->fb;
+}
+
+/* 16-byte instrument record shared by SBI and IBK */
+static void decode_sbi(OPL_MIDI_PATCH *patch, const uint8_t *d) {
+  decode_op(&patch->op[0], d[0], d[2], d[4], d[6], d[8]);
+  decode_op(&patch->op[1], d[1], d[3], d[5], d[7], d[9]);
+  decode_c0(patch, d[10]);
+}
+
+static void copy_name(char *dst, const uint8_t *src, uint32_t length) {
+  uint32_t i;
+  for (i = 0; i < length && i < 32 && src[i]; i++) {
+    dst[i] = (char)src[i];
+  }
+  dst[i] = '\0';
+}
+
+static OPL_BANK *alloc_bank(uint32_t count, uint8_t drums) {
+  OPL_BANK *bank = (OPL_BANK *)calloc(1, sizeof(OPL_BANK));
+  if (bank == NULL)
+    return NULL;
+  bank->count = count;
+  bank->patch = (OPL_MIDI_PATCH *)calloc(count < 128 ? 128 : count, sizeof(OPL_MIDI_PATCH));
+  bank->name = (char(*)[33])calloc(count ? count : 1, sizeof(bank->name[0]));
+  if (drums) {
+    bank->drums = (OPL_MIDI_PATCH *)calloc(128, sizeof(OPL_MIDI_PATCH));
+  }
+  if (bank->patch == NULL || bank->name == NULL || (drums && bank->drums == NULL)) {
+    OPL_BANK_delete(bank);
+    return NULL;
+  }
+  return bank;
+}
+
+static OPL_BANK *load_sbi(const uint8_t *data, uint32_t size) {
+  OPL_BANK *bank;
+  if (size < 4 + 32 + 11)
+    return NULL;
+  bank = alloc_bank(1, 0);
+  if (bank == NULL)
+    return NULL;
+  copy_name(bank->name[0], data + 4, 32);
+  decode_sbi(&bank->patch[0], data + 36);
+  return bank;
+}
+
+static OPL_BANK *load_ibk(const uint8_t *data, uint32_t size) {
+  OPL_BANK *bank;
+  uint32_t i;
+  if (size < 4 + 128 * 16 + 128 * 9)
+    return NULL;
+  bank = alloc_bank(128, 0);
+  if (bank == NULL)
+    return NULL;
+  for (i = 0; i < 128; i++) {
+    decode_sbi(&bank->patch[i], data + 4 + i * 16);
+    copy_name(bank->name[i], data + 4 + 128 * 16 + i * 9, 9);
+  }
+  return bank;
+}
+
+/* BNK operator record: ksl, multiple, feedback, attack, sustain, eg, decay, release, level, am, vib, ksr, con */
+static void decode_bnk_op(OPL_PATCH *p, const uint8_t *d, uint8_t wave) {
+  p->KL = d[0] & 3;
+  p->ML = d[1] & 15;
+  p->FB = d[2] & 7;
+  p->AR = d[3] & 15;
+  p->SL = d[4] & 15;
+  p->EG = d[5] ? 1 : 0;
+  p->DR = d[6] & 15;
+  p->RR = d[7] & 15;
+  p->TL = d[8] & 63;
+  p->AM = d[9] ? 1 : 0;
+  p->PM = d[10] ? 1 : 0;
+  p->KR = d[11] ? 1 : 0;
+  p->WS = wave & 3;
+}
+
+static OPL_BANK *load_bnk(const uint8_t *data, uint32_t size) {
+  OPL_BANK *bank;
+  uint32_t count, names, records, i;
+
+  if (size < 28)
+    return NULL;
+  count = read16(data + 8);
+  names = read32(data + 12);
+  records = read32(data + 16);
+  /* offsets come from the file: compare against the remaining size so that nothing can wrap */
+  if (names > size || count > (size - names) / 12)
+    return NULL;
+
+  bank = alloc_bank(count, 0);
+  if (bank == NULL)
+    return NULL;
+
+  for (i = 0; i < count; i++) {
+    const uint8_t *n = data + names + i * 12;
+    const uint32_t index = read16(n);
+    const uint8_t *d;
+    OPL_MIDI_PATCH *patch = &bank->patch[i];
+    if (records > size || index >= (size - records) / 30) {
+      OPL_BANK_delete(bank);
+      return NULL;
+    }
+    d = data + records + index * 30;
+    copy_name(bank->name[i], n + 3, 9);
+    decode_bnk_op(&patch->op[0], d + 2, d[28]);
+    decode_bnk_op(&patch->op[1], d + 15, d[29]);
+    patch->fb = patch->op[0].FB;
+    patch->alg = d[2 + 12] ? 0 : 1; /* con: 1 for FM */
+    patch->op[1].FB = 0;
+  }
+  return bank;
+}
+
+/* OP2 voice: mod 20, 60, 80, E0, ksl, level, feedback, car 20, 60, 80, E0, ksl, level, unused, note offset */
+static void decode_op2_voice(OPL_MIDI_PATCH *patch, const uint8_t *v) {
+  decode_op(&patch->op[0], v[0], v[4] | v[5], v[1], v[2], v[3]);
+  decode_op(&patch->op[1], v[7], v[11] | v[12], v[8], v[9], v[10]);
+  decode_c0(patch, v[6]);
+  patch->transpose = (int8_t)read16(v + 14);
+}
+
+static OPL_BANK *load_op2(const uint8_t *data, uint32_t size) {
+  OPL_BANK *bank;
+  uint32_t i;
+
+  if (size < 8 + OP2_COUNT * 36 + OP2_COUNT * 32)
+    return NULL;
+  bank = alloc_bank(OP2_COUNT, 1);
+  if (bank == NULL)
+    return NULL;
+
+  for (i = 0; i < OP2_COUNT; i++) {
+    const uint8_t *d = data + 8 + i * 36;
+    OPL_MIDI_PATCH *patch = &bank->patch[i];
+    /* only the first voice is used; double-voice instruments are played with one channel */
+    decode_op2_voice(patch, d + 4);
+    if (read16(d) & 1) {
+      patch->fixed_note = d[3];
+    }
+    copy_name(bank->name[i], data + 8 + OP2_COUNT * 36 + i * 32, 32);
+    if (i >= OP2_MELODIC) {
+      bank->drums[OP2_FIRST_DRUM + i - OP2_MELODIC] = *patch;
+    }
+  }
+  return bank;
+}
+
+OPL_BANK *OPL_BANK_load(const uint8_t *data, uint32_t size) {
+  if (size >= 4 && memcmp(data, "SBI\x1a", 4) == 0)
+    return load_sbi(data, size);
+  if (size >= 4 && memcmp(data, "IBK\x1a", 4) == 0)
+    return load_ibk(data, size);
+  if (size >= 8 && memcmp(data, "#OPL_II#", 8) == 0)
+    return load_op2(data, size);
+  if (size >= 8 && memcmp(data + 2, "ADLIB-", 6) == 0)
+    return load_bnk(data, size);
+  return NULL;
+}
+
+OPL_BANK *OPL_BANK_loadFile(const char *path) {
+  OPL_BANK *bank = NULL;
+  uint8_t *data;
+  long size;
+  FILE *fp = fopen(path, "rb");
+
+  if (fp == NULL)
+    return NULL;
+  if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0) {
+    data = (uint8_t *)malloc(size);
+    if (data != NULL && fread(data, 1, size, fp) == (size_t)size) {
+      bank = OPL_BANK_load(data, (uint32_t)size);
+    }
+    free(data);
+  }
+  fclose(fp);
+  return bank;
+}
+
+void OPL_BANK_delete(OPL_BANK *bank) {
+  if (bank == NULL)
+    return;
+  free(bank->patch);
+  free(bank->name);
+  free(bank->drums);
+  free(bank);
+}
+
+void OPL_BANK_apply(const OPL_BANK *bank, uint32_t index, OPL *opl, uint32_t ch) {
+  const OPL_MIDI_PATCH *patch;
+  if (index >= bank->count)
+    return;
+  patch = &bank->patch[index];
+  OPL_setChannelPatch(opl, ch, patch->op, patch->fb, patch->alg);
+}
@@ -0,0 +1,38 @@
+#ifndef _EMUBANK_H_
+#define _EMUBANK_H_
+
+#include "emumidi.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Instrument bank decoded from .SBI, .IBK, .BNK (AdLib Visual Composer) or .OP2 (DMX GENMIDI).
+ * Instruments are decoded once into the slot representation (OPL_PATCH), so applying one is a copy
+ * through OPL_setChannelPatch with no register decode.
+ */
+typedef struct __OPL_BANK {
+  uint32_t count;         /* number of instruments in the file */
+  OPL_MIDI_PATCH *patch;  /* instruments; at least 128 entries (zero-filled past count) for OPL_MIDI_setPatches */
+  char (*name)[33];       /* NUL-terminated names, count entries */
+  OPL_MIDI_PATCH *drums;  /* 128 percussion patches indexed by note (OP2 only), or NULL */
+} OPL_BANK;
+
+/**
+ * Decode a bank. The format is detected from the file signature.
+ * @returns NULL if the data is truncated, of an unknown format, or memory could not be allocated.
+ */
+OPL_BANK *OPL_BANK_load(const uint8_t *data, uint32_t size);
+OPL_BANK *OPL_BANK_loadFile(const char *path);
+void OPL_BANK_delete(OPL_BANK *bank);
+
+/* load instrument `index` of the bank into channel ch (0..8) */
+void OPL_BANK_apply(const OPL_BANK *bank, uint32_t index, OPL *opl, uint32_t ch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,517 @@
+/**
+ * MIDI front end for emu8950
+ */
+#include "emumidi.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define DRUM_CHANNEL 9
+#define RPN_NONE 0x3fff
+
+/* register offset of the modulator of each channel. the carrier is at +3 */
+static const uint8_t op_offset[9] = {0x00, 0x01, 0x02, 0x08, 0x09, 0x0a, 0x10, 0x11, 0x12};
+
+/* used when no instrument table is set */
+static const OPL_MIDI_PATCH default_patch = {
+    /* TL, FB, EG, ML, AR, DR, SL, RR, KR, KL, AM, PM, WS */
+    {{28, 0, 1, 1, 15, 2, 5, 5, 0, 1, 0, 0, 0}, {0, 0, 1, 1, 15, 3, 4, 6, 0, 0, 0, 0, 0}},
+    4,
+    0,
+    0,
+    0};
+
+/* rhythm instruments in $BD */
+#define R_BD 0x10
+#define R_SD 0x08
+#define R_TOM 0x04
+#define R_CYM 0x02
+#define R_HH 0x01
+
+/* fixed notes of channel 6, 7 and 8 in rhythm mode */
+static const uint8_t rhythm_note[3] = {36, 60, 55};
+
+static void queue_write(OPL_MIDI *midi, uint64_t time, uint32_t reg, uint8_t val) {
+  OPL_queueWrite(midi->opl, time, reg, val);
+}
+
+static uint8_t rhythm_bit(uint8_t note) {
+  switch (note) {
+  case 35:
+  case 36:
+    return R_BD;
+  case 37:
+  case 38:
+  case 39:
+  case 40:
+    return R_SD;
+  case 41:
+  case 43:
+  case 45:
+  case 47:
+  case 48:
+  case 50:
+    return R_TOM;
+  case 42:
+  case 44:
+  case 46:
+    return R_HH;
+  case 49:
+  case 51:
+  case 52:
+  case 53:
+  case 55:
+  case 57:
+  case 59:
+    return R_CYM;
+  default:
+    return 0;
+  }
+}
+
+static uint8_t attenuate(OPL_MIDI *midi, uint8_t tl, uint8_t ch, uint8_t velocity) {
+  const OPL_MIDI_CHANNEL *c = &midi->channel[ch];
+  uint32_t res = tl + midi->level_table[velocity] + midi->level_table[c->volume] + midi->level_table[c->expression];
+  return res < 63 ? res : 63;
+}
+
+static void make_fnum_table(OPL_MIDI *midi) {
+  int i;
+  midi->fnum_rate = OPL_internalRate(midi->opl);
+  for (i = 0; i < 12 * 32; i++) {
+    /* C-1 (MIDI note 0) is 8.1758Hz */
+    const double freq = 440.0 * pow(2.0, (i / 32.0 - 69.0) / 12.0);
+    midi->fnum_table[i] = (uint16_t)(freq * (1 << 21) / midi->fnum_rate + 0.5);
+  }
+}
+
+static void calc_freq(OPL_MIDI *midi, const OPL_MIDI_VOICE *v, uint8_t *a0, uint8_t *b0) {
+  const OPL_MIDI_CHANNEL *c = &midi->channel[v->channel];
+  int32_t note = v->patch->fixed_note ? v->patch->fixed_note : v->note + v->patch->transpose;
+  int32_t p = note * 32 + c->bend * c->bend_range / 256; /* 1/32 semitone */
+  int32_t fnum, block;
+
+  if (p < 0)
+    p = 0;
+  if (p >= 128 * 32)
+    p = 128 * 32 - 1;
+
+  /* the chip type, and so the internal rate, may have changed since the table was made */
+  if (midi->fnum_rate != OPL_internalRate(midi->opl))
+    make_fnum_table(midi);
+
+  fnum = midi->fnum_table[p % (12 * 32)];
+  block = p / (12 * 32) - 1;
+  if (block < 0) {
+    fnum >>= 1;
+    block = 0;
+  }
+  for (; block > 7; block--) {
+    fnum <<= 1;
+  }
+  if (fnum > 1023)
+    fnum = 1023;
+
+  *a0 = fnum & 0xff;
+  *b0 = (block << 2) | (fnum >> 8);
+}
+
+/* patch writes may bypass the queue when they are due and nothing queued precedes them */
+static int is_due(OPL_MIDI *midi, uint64_t time) {
+  const OPL *opl = midi->opl;
+  return time <= opl->sample_count && (opl->queue_len == 0 || opl->queue[opl->queue_head].time > time);
+}
+
+static void write_patch(OPL_MIDI *midi, uint64_t time, int i, const OPL_MIDI_PATCH *patch, const OPL_PATCH op[2]) {
+  int k;
+
+  if (is_due(midi, time)) {
+    OPL_setChannelPatch(midi->opl, i, op, patch->fb, patch->alg);
+    return;
+  }
+
+  for (k = 0; k < 2; k++) {
+    const OPL_PATCH *p = &op[k];
+    const uint8_t o = op_offset[i] + k * 3;
+    queue_write(midi, time, 0x20 + o, (p->AM << 7) | (p->PM << 6) | (p->EG << 5) | (p->KR << 4) | p->ML);
+    queue_write(midi, time, 0x40 + o, (p->KL << 6) | p->TL);
+    queue_write(midi, time, 0x60 + o, (p->AR << 4) | p->DR);
+    queue_write(midi, time, 0x80 + o, (p->SL << 4) | p->RR);
+    queue_write(midi, time, 0xe0 + o, p->WS);
+  }
+  queue_write(midi, time, 0xc0 + i, (patch->fb << 1) | patch->alg);
+}
+
+/* operators of the voice's patch with levels scaled by velocity, volume and expression */
+static void voice_operators(OPL_MIDI *midi, const OPL_MIDI_VOICE *v, OPL_PATCH op[2]) {
+  op[0] = v->patch->op[0];
+  op[1] = v->patch->op[1];
+  if (v->patch->alg) {
+    op[0].TL = attenuate(midi, op[0].TL, v->channel, v->velocity);
+  }
+  op[1].TL = attenuate(midi, op[1].TL, v->channel, v->velocity);
+}
+
+static void update_level(OPL_MIDI *midi, uint64_t time, int i) {
+  OPL_PATCH op[2];
+  voice_operators(midi, &midi->voice[i], op);
+  queue_write(midi, time, 0x40 + op_offset[i], (op[0].KL << 6) | op[0].TL);
+  queue_write(midi, time, 0x43 + op_offset[i], (op[1].KL << 6) | op[1].TL);
+}
+
+static void update_freq(OPL_MIDI *midi, uint64_t time, int i) {
+  OPL_MIDI_VOICE *v = &midi->voice[i];
+  uint8_t a0, b0;
+  calc_freq(midi, v, &a0, &b0);
+  v->regB0 = (v->regB0 & 0x20) | b0;
+  queue_write(midi, time, 0xa0 + i, a0);
+  queue_write(midi, time, 0xb0 + i, v->regB0);
+}
+
+static void key_off(OPL_MIDI *midi, uint64_t time, int i) {
+  OPL_MIDI_VOICE *v = &midi->voice[i];
+  v->on = 0;
+  v->sustained = 0;
+  v->serial = ++midi->serial;
+  if (v->regB0 & 0x20) {
+    v->regB0 &= ~0x20;
+    queue_write(midi, time, 0xb0 + i, v->regB0);
+  }
+}
+
+/* prefer a free voice that already holds the patch, then any free voice, then the oldest sustained one,
+ * and steal the oldest held voice last */
+static int alloc_voice(OPL_MIDI *midi, uint8_t ch, uint8_t note, const OPL_MIDI_PATCH *patch) {
+  int i, best = 0;
+  uint32_t best_rank = 0xffffffff;
+
+  for (i = 0; i < midi->voice_count; i++) {
+    const OPL_MIDI_VOICE *v = &midi->voice[i];
+    uint32_t rank;
+    if ((v->on || v->sustained) && v->channel == ch && v->note == note)
+      return i;
+    rank = (v->on ? 2 : v->sustained ? 1 : 0) * 2 + (v->patch != patch);
+    if (rank < best_rank || (rank == best_rank && v->serial < midi->voice[best].serial)) {
+      best = i;
+      best_rank = rank;
+    }
+  }
+  return best;
+}
+
+static void rhythm_on(OPL_MIDI *midi, uint64_t time, uint8_t note, uint8_t velocity) {
+  const uint8_t bit = rhythm_bit(note);
+  int k, op;
+
+  if (bit == 0)
+    return;
+
+  if (midi->rhythm) {
+    /* channel and operator of the instrument */
+    k = bit == R_BD ? 0 : (bit == R_HH || bit == R_SD) ? 1 : 2;
+    op = (bit == R_HH || bit == R_TOM) ? 0 : 1;
+    queue_write(midi, time, 0x40 + op_offset[6 + k] + op * 3,
+                (midi->rhythm[k].op[op].KL << 6) | attenuate(midi, midi->rhythm[k].op[op].TL, DRUM_CHANNEL, velocity));
+  }
+  queue_write(midi, time, 0xbd, midi->regBD & ~bit);
+  midi->regBD |= bit;
+  queue_write(midi, time, 0xbd, midi->regBD);
+}
+
+static void rhythm_off(OPL_MIDI *midi, uint64_t time, uint8_t note) {
+  const uint8_t bit = rhythm_bit(note);
+  if (bit && (midi->regBD & bit)) {
+    midi->regBD &= ~bit;
+    queue_write(midi, time, 0xbd, midi->regBD);
+  }
+}
+
+static void reset_controllers(OPL_MIDI *midi, uint64_t time, uint8_t ch) {
+  OPL_MIDI_CHANNEL *c = &midi->channel[ch];
+  int i;
+  c->expression = 127;
+  c->sustain = 0;
+  c->bend = 0;
+  c->rpn = RPN_NONE;
+  for (i = 0; i < midi->voice_count; i++) {
+    if (midi->voice[i].channel == ch && midi->voice[i].sustained) {
+      key_off(midi, time, i);
+    }
+  }
+}
+
+OPL_MIDI *OPL_MIDI_new(OPL *opl) {
+  OPL_MIDI *midi;
+  int i;
+
+  midi = (OPL_MIDI *)calloc(1, sizeof(OPL_MIDI));
+  if (midi == NULL)
+    return NULL;
+
+  midi->opl = opl;
+  midi->voice_count = 9;
+
+  make_fnum_table(midi);
+
+  midi->level_table[0] = 63;
+  for (i = 1; i < 128; i++) {
+    const double att = -40.0 * log10(i / 127.0) / 0.75;
+    midi->level_table[i] = att < 63 ? (uint8_t)(att + 0.5) : 63;
+  }
+
+  OPL_MIDI_reset(midi, opl->sample_count);
+
+  return midi;
+}
+
+void OPL_MIDI_delete(OPL_MIDI *midi) { free(midi); }
+
+void OPL_MIDI_reset(OPL_MIDI *midi, uint64_t time) {
+  int i;
+
+  for (i = 0; i < 9; i++) {
+    key_off(midi, time, i);
+    midi->voice[i].channel = 0xff;
+    midi->voice[i].patch = NULL;
+  }
+
+  for (i = 0; i < 16; i++) {
+    midi->channel[i].program = 0;
+    midi->channel[i].volume = 100;
+    midi->channel[i].bend_range = 2;
+    reset_controllers(midi, time, i);
+  }
+
+  midi->regBD &= 0x20;
+  queue_write(midi, time, 0x01, 0x20);
+  queue_write(midi, time, 0xbd, midi->regBD);
+}
+
+void OPL_MIDI_setPatches(OPL_MIDI *midi, const OPL_MIDI_PATCH *melodic, const OPL_MIDI_PATCH *drums) {
+  midi->melodic = melodic;
+  midi->drums = drums;
+}
+
+void OPL_MIDI_setRhythmMode(OPL_MIDI *midi, uint64_t time, uint8_t enable, const OPL_MIDI_PATCH rhythm[3]) {
+  int i;
+
+  for (i = 6; i < 9; i++) {
+    key_off(midi, time, i);
+    midi->voice[i].channel = 0xff;
+    midi->voice[i].patch = NULL;
+  }
+
+  midi->rhythm_mode = enable ? 1 : 0;
+  midi->rhythm = enable ? rhythm : NULL;
+  midi->voice_count = enable ? 6 : 9;
+
+  if (enable) {
+    for (i = 6; i < 9; i++) {
+      OPL_MIDI_VOICE v = midi->voice[i];
+      uint8_t a0, b0;
+      if (rhythm) {
+        write_patch(midi, time, i, &rhythm[i - 6], rhythm[i - 6].op);
+      }
+      v.channel = DRUM_CHANNEL;
+      v.note = rhythm_note[i - 6];
+      v.patch = &default_patch;
+      calc_freq(midi, &v, &a0, &b0);
+      midi->voice[i].regB0 = b0;
+      queue_write(midi, time, 0xa0 + i, a0);
+      queue_write(midi, time, 0xb0 + i, b0);
+    }
+  }
+
+  midi->regBD = enable ? 0x20 : 0x00;
+  queue_write(midi, time, 0xbd, midi->regBD);
+}
+
+void OPL_MIDI_noteOn(OPL_MIDI *midi, uint64_t time, uint8_t ch, uint8_t note, uint8_t velocity) {
+  const OPL_MIDI_PATCH *patch;
+  OPL_MIDI_VOICE *v;
+  int i;
+
+  ch &= 15;
+  note &= 127;
+  velocity &= 127;
+
+  if (velocity == 0) {
+    OPL_MIDI_noteOff(midi, time, ch, note);
+    return;
+  }
+
+  if (ch == DRUM_CHANNEL) {
+    if (midi->rhythm_mode) {
+      rhythm_on(midi, time, note, velocity);
+      return;
+    }
+    if (midi->drums == NULL)
+      return;
+    patch = &midi->drums[note];
+  } else {
+    patch = midi->melodic ? &midi->melodic[midi->channel[ch].program] : &default_patch;
+  }
+
+  i = alloc_voice(midi, ch, note, patch);
+  v = &midi->voice[i];
+
+  /* the patch goes first so that it can take the bulk path; the key-off of a stolen voice is applied
+   * on the same sample, before anything is synthesized */
+  if (v->patch != patch) {
+    OPL_PATCH op[2];
+    v->patch = patch;
+    v->channel = ch;
+    v->velocity = velocity;
+    voice_operators(midi, v, op);
+    write_patch(midi, time, i, patch, op);
+  } else {
+    v->channel = ch;
+    v->velocity = velocity;
+    update_level(midi, time, i);
+  }
+  key_off(midi, time, i);
+  v->note = note;
+  v->on = 1;
+  v->serial = ++midi->serial;
+
+  v->regB0 |= 0x20;
+  update_freq(midi, time, i);
+}
+
+void OPL_MIDI_noteOff(OPL_MIDI *midi, uint64_t time, uint8_t ch, uint8_t note) {
+  int i;
+
+  ch &= 15;
+  note &= 127;
+
+  if (ch == DRUM_CHANNEL && midi->rhythm_mode) {
+    rhythm_off(midi, time, note);
+    return;
+  }
+
+  for (i = 0; i < midi->voice_count; i++) {
+    OPL_MIDI_VOICE *v = &midi->voice[i];
+    if (v->on && v->channel == ch && v->note == note) {
+      if (midi->channel[ch].sustain) {
+        v->on = 0;
+        v->sustained = 1;
+      } else {
+        key_off(midi, time, i);
+      }
+    }
+  }
+}
+
+void OPL_MIDI_programChange(OPL_MIDI *midi, uint64_t time, uint8_t ch, uint8_t program) {
+  (void)time;
+  midi->channel[ch & 15].program = program & 127;
+}
+
+void OPL_MIDI_controlChange(OPL_MIDI *midi, uint64_t time, uint8_t ch, uint8_t cc, uint8_t value) {
+  OPL_MIDI_CHANNEL *c;
+  int i;
+
+  ch &= 15;
+  value &= 127;
+  c = &midi->channel[ch];
+
+  switch (cc) {
+  case 7:
+  case 11:
+    if (cc == 7)
+      c->volume = value;
+    else
+      c->expression = value;
+    for (i = 0; i < midi->voice_count; i++) {
+      if (midi->voice[i].channel == ch && (midi->voice[i].on || midi->voice[i].sustained)) {
+        update_level(midi, time, i);
+      }
+    }
+    break;
+  case 64:
+    c->sustain = value >= 64;
+    if (!c->sustain) {
+      for (i = 0; i < midi->voice_count; i++) {
+        if (midi->voice[i].channel == ch && midi->voice[i].sustained) {
+          key_off(midi, time, i);
+        }
+      }
+    }
+    break;
+  case 101:
+    c->rpn = (value << 7) | (c->rpn & 0x7f);
+    break;
+  case 100:
+    c->rpn = (c->rpn & 0x3f80) | value;
+    break;
+  case 6:
+    if (c->rpn == 0)
+      c->bend_range = value;
+    break;
+  case 120:
+  case 123:
+    for (i = 0; i < midi->voice_count; i++) {
+      if (midi->voice[i].channel == ch && (midi->voice[i].on || midi->voice[i].sustained)) {
+        key_off(midi, time, i);
+      }
+    }
+    if (ch == DRUM_CHANNEL && midi->rhythm_mode && (midi->regBD & 0x1f)) {
+      midi->regBD &= 0x20;
+      queue_write(midi, time, 0xbd, midi->regBD);
+    }
+    break;
+  case 121:
+    reset_controllers(midi, time, ch);
+    break;
+  default:
+    break;
+  }
+}
+
+void OPL_MIDI_pitchBend(OPL_MIDI *midi, uint64_t time, uint8_t ch, uint16_t value) {
+  int i;
+
+  ch &= 15;
+  midi->channel[ch].bend = (int16_t)(value & 0x3fff) - 8192;
+
+  for (i = 0; i < midi->voice_count; i++) {
+    if (midi->voice[i].channel == ch && midi->voice[i].patch) {
+      update_freq(midi, time, i);
+    }
+  }
+}
+
+uint32_t OPL_MIDI_message(OPL_MIDI *midi, uint64_t time, const uint8_t *msg, uint32_t length) {
+  uint8_t status, ch;
+  uint32_t size;
+
+  if (length < 1 || !(msg[0] & 0x80) || msg[0] >= 0xf0)
+    return 0;
+
+  status = msg[0] & 0xf0;
+  ch = msg[0] & 15;
+  size = (status == 0xc0 || status == 0xd0) ? 2 : 3;
+  if (length < size)
+    return 0;
+
+  switch (status) {
+  case 0x80:
+    OPL_MIDI_noteOff(midi, time, ch, msg[1]);
+    break;
+  case 0x90:
+    OPL_MIDI_noteOn(midi, time, ch, msg[1], msg[2]);
+    break;
+  case 0xb0:
+    OPL_MIDI_controlChange(midi, time, ch, msg[1], msg[2]);
+    break;
+  case 0xc0:
+    OPL_MIDI_programChange(midi, time, ch, msg[1]);
+    break;
+  case 0xe0:
+    OPL_MIDI_pitchBend(midi, time, ch, (msg[1] & 0x7f) | ((msg[2] & 0x7f) << 7));
+    break;
+  default:
+    break;
+  }
+
+  return size;
+}
@@ -0,0 +1,116 @@
+#ifndef _EMUMIDI_H_
+#define _EMUMIDI_H_
+
+#include "emu8950.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* instrument for one OPL channel */
+typedef struct __OPL_MIDI_PATCH {
+  OPL_PATCH op[2];    /* [0] modulator, [1] carrier */
+  uint8_t fb;         /* feedback 0..7 */
+  uint8_t alg;        /* 0:FM 1:AM */
+  int8_t transpose;   /* semitones added to the played note */
+  uint8_t fixed_note; /* if not 0, always played at this note (percussion) */
+} OPL_MIDI_PATCH;
+
+typedef struct __OPL_MIDI_VOICE {
+  uint8_t channel; /* MIDI channel, 0xff if never used */
+  uint8_t note;
+  uint8_t velocity;
+  uint8_t on;        /* key held */
+  uint8_t sustained; /* released while the sustain pedal is down */
+  uint8_t regB0;     /* shadow of $B0+ch (key-on, block, f-num high) */
+  uint32_t serial;   /* order of the last note-on or release, for stealing */
+  const OPL_MIDI_PATCH *patch;
+} OPL_MIDI_VOICE;
+
+typedef struct __OPL_MIDI_CHANNEL {
+  uint8_t program;
+  uint8_t volume;
+  uint8_t expression;
+  uint8_t sustain;
+  uint8_t bend_range; /* semitones */
+  int16_t bend;       /* -8192..8191 */
+  uint16_t rpn;
+} OPL_MIDI_CHANNEL;
+
+/* MIDI front end driving an OPL instance through its write queue */
+typedef struct __OPL_MIDI {
+  OPL *opl;
+
+  const OPL_MIDI_PATCH *melodic; /* 128 programs */
+  const OPL_MIDI_PATCH *drums;   /* 128 notes of MIDI channel 10, or NULL */
+
+  OPL_MIDI_CHANNEL channel[16];
+  OPL_MIDI_VOICE voice[9];
+  uint8_t voice_count; /* 9, or 6 in rhythm mode */
+  uint32_t serial;
+
+  uint8_t rhythm_mode;
+  const OPL_MIDI_PATCH *rhythm; /* patches of channel 6, 7 and 8 in rhythm mode, or NULL */
+  uint8_t regBD;                /* shadow of $BD */
+
+  /* f-number for each 1/32 semitone of an octave, played at block (octave - 1) */
+  uint16_t fnum_table[12 * 32];
+  uint32_t fnum_rate; /* internal rate of the chip fnum_table was computed for (see OPL_internalRate) */
+  /* attenuation in TL steps (0.75dB) for a 7-bit level, 40log10 curve */
+  uint8_t level_table[128];
+
+} OPL_MIDI;
+
+/**
+ * Create a MIDI front end for `opl`. The OPL instance is not owned and must outlive the returned object.
+ * Waveform select is enabled on YM3812 so that patches can use all 4 waveforms.
+ */
+OPL_MIDI *OPL_MIDI_new(OPL *opl);
+void OPL_MIDI_delete(OPL_MIDI *midi);
+
+/**
+ * Release all voices and reset controllers.
+ * @param time output sample time of the register writes (see OPL_queueWrite).
+ */
+void OPL_MIDI_reset(OPL_MIDI *midi, uint64_t time);
+
+/**
+ * Set instrument tables. Arrays are referenced, not copied.
+ * @param melodic 128 programs, or NULL for the built-in default instrument.
+ * @param drums 128 patches indexed by note for MIDI channel 10, or NULL to ignore channel 10 in melodic mode.
+ */
+void OPL_MIDI_setPatches(OPL_MIDI *midi, const OPL_MIDI_PATCH *melodic, const OPL_MIDI_PATCH *drums);
+
+/**
+ * Switch between 9 melodic voices and 6 melodic voices plus the rhythm section.
+ * In rhythm mode MIDI channel 10 plays BD, SD, TOM, CYM and HH at fixed pitches, with operator settings
+ * taken from `rhythm` (channels 6, 7 and 8: BD, HH/SD, TOM/CYM), or left as they are if NULL.
+ */
+void OPL_MIDI_setRhythmMode(OPL_MIDI *midi, uint64_t time, uint8_t enable, const OPL_MIDI_PATCH rhythm[3]);
+
+/**
+ * MIDI events. `time` is the output sample at which the event is heard; events are turned into
+ * register writes on the OPL write queue, so a note-on is audible from exactly that sample regardless of
+ * how the host splits rendering into blocks. A time already passed means the next sample.
+ */
+void OPL_MIDI_noteOn(OPL_MIDI *midi, uint64_t time, uint8_t ch, uint8_t note, uint8_t velocity);
+void OPL_MIDI_noteOff(OPL_MIDI *midi, uint64_t time, uint8_t ch, uint8_t note);
+void OPL_MIDI_programChange(OPL_MIDI *midi, uint64_t time, uint8_t ch, uint8_t program);
+/* supports volume(7), expression(11), sustain(64), RPN 0 bend range(100/101/6/38), all sound/notes off(120/123)
+ * and reset all controllers(121) */
+void OPL_MIDI_controlChange(OPL_MIDI *midi, uint64_t time, uint8_t ch, uint8_t cc, uint8_t value);
+/* @param value 0..16383, 8192 is center */
+void OPL_MIDI_pitchBend(OPL_MIDI *midi, uint64_t time, uint8_t ch, uint16_t value);
+
+/**
+ * Dispatch a MIDI channel message (running status is not supported).
+ * @returns number of bytes consumed, or 0 if the message is incomplete or not a channel message.
+ */
+uint32_t OPL_MIDI_message(OPL_MIDI *midi, uint64_t time, const uint8_t *msg, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
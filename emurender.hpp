@@ -0,0 +1,255 @@
+/**
+ * Background render-ahead for emu8950 (C++17 or later).
+ *
+ * A render thread keeps a fixed lead of frames in a lock-free SPSC ring, so the audio callback only copies
+ * samples out. Register writes pass through a second SPSC ring and are stamped with an output frame time,
+ * so they land at a constant distance (the lead) from the frame being played. The render thread sleeps while the
+ * lead is full and is woken by the reader.
+ */
+#ifndef _EMURENDER_HPP_
+#define _EMURENDER_HPP_
+
+#include "emu8950.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace opl {
+
+/**
+ * Lock-free single-producer single-consumer ring. Capacity is rounded up to a power of 2.
+ * The producer may render in place through writeRegion()/commit().
+ */
+template <typename T> class SPSCRing {
+public:
+  explicit SPSCRing(std::size_t capacity) {
+    std::size_t cap = 1;
+    while (cap < capacity)
+      cap <<= 1;
+    buf_.reset(new T[cap]);
+    mask_ = cap - 1;
+  }
+  SPSCRing(const SPSCRing &) = delete;
+  SPSCRing &operator=(const SPSCRing &) = delete;
+
+  std::size_t capacity() const noexcept { return mask_ + 1; }
+  /* number of readable elements (exact on the consumer side, a lower bound elsewhere) */
+  std::size_t size() const noexcept {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  /* producer: contiguous writable region of at most n elements; returns its length */
+  std::size_t writeRegion(T *&ptr, std::size_t n) noexcept {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    const std::size_t space = capacity() - (head - tail_.load(std::memory_order_acquire));
+    const std::size_t linear = capacity() - (head & mask_);
+    ptr = &buf_[head & mask_];
+    return min(n, min(space, linear));
+  }
+  /* producer: publish n elements of the region returned by writeRegion */
+  void commit(std::size_t n) noexcept { head_.store(head_.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+  bool push(const T &v) noexcept {
+    T *p;
+    if (writeRegion(p, 1) == 0)
+      return false;
+    *p = v;
+    commit(1);
+    return true;
+  }
+
+  /* consumer: pop up to n elements into out; returns the number popped */
+  std::size_t pop(T *out, std::size_t n) noexcept {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    const std::size_t count = min(n, head_.load(std::memory_order_acquire) - tail);
+    const std::size_t first = min(count, capacity() - (tail & mask_));
+    std::memcpy(out, &buf_[tail & mask_], first * sizeof(T));
+    std::memcpy(out + first, &buf_[0], (count - first) * sizeof(T));
+    tail_.store(tail + count, std::memory_order_release);
+    return count;
+  }
+  bool pop(T &v) noexcept { return pop(&v, 1) == 1; }
+
+private:
+  static std::size_t min(std::size_t a, std::size_t b) noexcept { return a < b ? a : b; }
+
+  std::unique_ptr<T[]> buf_;
+  std::size_t mask_;
+  alignas(64) std::atomic<std::size_t> head_{0}; /* written by the producer */
+  alignas(64) std::atomic<std::size_t> tail_{0}; /* written by the consumer */
+};
+
+/* what read() does when the ring runs dry */
+enum class Underrun : uint8_t {
+  Silence,    /* fill the rest of the request with zeros */
+  RepeatLast, /* hold the last frame delivered */
+  Partial,    /* return fewer frames than requested */
+};
+
+struct RenderConfig {
+  double lead_ms = 20.0;          /* frames kept rendered ahead of the reader */
+  std::size_t block_frames = 128; /* frames rendered per iteration of the render thread */
+  std::size_t write_capacity = 4096;
+  Underrun underrun = Underrun::Silence;
+};
+
+struct RenderStats {
+  std::size_t buffered_frames; /* frames rendered but not yet read */
+  double latency_ms;           /* register-to-output latency of write(reg, value), excluding the device buffer */
+  uint64_t underruns;          /* read() calls that ran dry */
+  uint64_t underrun_frames;    /* frames missing in those calls */
+  uint64_t late_writes;        /* writes applied after the frame they were stamped for */
+  uint64_t dropped_writes;     /* writes lost because the chip's write queue could not grow */
+};
+
+/**
+ * Chip rendered ahead on a background thread into interleaved stereo frames of type T.
+ * read() is lock-free and never blocks and is meant for the audio callback; write() is lock-free and meant for
+ * one control thread. Timer callbacks set on the chip run on the render thread. No exception escapes the
+ * render thread: a write that cannot be queued on the chip is dropped and counted in RenderStats.
+ */
+template <ChipType Type = ChipType::Y8950, typename T = float> class BackgroundRenderer {
+public:
+  explicit BackgroundRenderer(uint32_t clock = 3579545, uint32_t rate = 44100, const RenderConfig &config = {})
+      : chip_(clock, rate), rate_(rate), config_(config),
+        lead_(static_cast<std::size_t>(config.lead_ms * rate / 1000.0 + 0.5)),
+        audio_((lead_ + config.block_frames) * 2), writes_(config.write_capacity) {
+    static_assert(detail::is_sample<T>::value, "sample type must be int16_t, int32_t or float");
+    if (config_.block_frames == 0)
+      config_.block_frames = 1;
+  }
+  ~BackgroundRenderer() { stop(); }
+  BackgroundRenderer(const BackgroundRenderer &) = delete;
+  BackgroundRenderer &operator=(const BackgroundRenderer &) = delete;
+
+  /* direct chip access, only while the render thread is stopped (initial setup, ADPCM uploads) */
+  Chip<Type> &chip() noexcept { return chip_; }
+
+  void start() {
+    if (!running_.exchange(true))
+      thread_ = std::thread([this] { run(); });
+  }
+  void stop() {
+    if (running_.exchange(false)) {
+      wake();
+      thread_.join();
+    }
+  }
+
+  /** Write a register, heard `lead` frames after the frame currently being read. */
+  bool write(uint32_t reg, uint8_t value) noexcept { return write(playPosition() + lead_, reg, value); }
+  bool write(Reg reg, uint8_t value) noexcept { return write(static_cast<uint32_t>(reg), value); }
+  /** Write a register at an absolute output frame. Returns false if the write ring is full. */
+  bool write(uint64_t time, uint32_t reg, uint8_t value) noexcept { return writes_.push(Write{time, reg, value}); }
+
+  /**
+   * Read interleaved stereo frames. Called from the audio callback.
+   * @returns number of frames stored; always `frames` unless the policy is Underrun::Partial.
+   */
+  std::size_t read(T *out, std::size_t frames) noexcept {
+    const std::size_t got = audio_.pop(out, frames * 2) / 2;
+    played_.store(played_.load(std::memory_order_relaxed) + got, std::memory_order_release);
+    wake();
+    if (got > 0) {
+      last_[0] = out[got * 2 - 2];
+      last_[1] = out[got * 2 - 1];
+    }
+    if (got == frames)
+      return frames;
+    underruns_.fetch_add(1, std::memory_order_relaxed);
+    underrun_frames_.fetch_add(frames - got, std::memory_order_relaxed);
+    if (config_.underrun == Underrun::Partial)
+      return got;
+    for (std::size_t i = got; i < frames; i++) {
+      out[i * 2] = config_.underrun == Underrun::RepeatLast ? last_[0] : T(0);
+      out[i * 2 + 1] = config_.underrun == Underrun::RepeatLast ? last_[1] : T(0);
+    }
+    return frames;
+  }
+
+  /* output frame currently at the head of the ring, i.e. the number of frames read so far */
+  uint64_t playPosition() const noexcept { return played_.load(std::memory_order_acquire); }
+  std::size_t leadFrames() const noexcept { return lead_; }
+
+  RenderStats stats() const noexcept {
+    RenderStats s;
+    s.buffered_frames = audio_.size() / 2;
+    s.latency_ms = 1000.0 * lead_ / rate_;
+    s.underruns = underruns_.load(std::memory_order_relaxed);
+    s.underrun_frames = underrun_frames_.load(std::memory_order_relaxed);
+    s.late_writes = late_writes_.load(std::memory_order_relaxed);
+    s.dropped_writes = dropped_writes_.load(std::memory_order_relaxed);
+    return s;
+  }
+
+private:
+  Chip<Type> chip_;
+  uint32_t rate_;
+  RenderConfig config_;
+  std::size_t lead_;
+  SPSCRing<T> audio_;
+  SPSCRing<Write> writes_;
+  T last_[2] = {T(0), T(0)};
+
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+  std::atomic<uint64_t> played_{0};
+  std::atomic<uint64_t> underruns_{0};
+  std::atomic<uint64_t> underrun_frames_{0};
+  std::atomic<uint64_t> late_writes_{0};
+  std::atomic<uint64_t> dropped_writes_{0};
+
+  /* wakeup of the render thread: wake_ counts read() and stop() calls */
+  std::atomic<uint32_t> wake_{0};
+  std::atomic<bool> sleeping_{false};
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cv_;
+
+  void wake() noexcept {
+    wake_.fetch_add(1, std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_seq_cst))
+      sleep_cv_.notify_one();
+  }
+
+  /* Sleep until wake_ moves past `seen`. The notification is sent without taking the mutex so that read()
+   * never blocks; if it slips in between the check and the wait, the next read() or the timeout wakes us. */
+  void waitForReader(uint32_t seen) {
+    const auto timeout = std::chrono::microseconds(500000 * lead_ / rate_ + 100);
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    sleeping_.store(true, std::memory_order_seq_cst);
+    sleep_cv_.wait_for(lock, timeout, [&] { return wake_.load(std::memory_order_seq_cst) != seen; });
+    sleeping_.store(false, std::memory_order_relaxed);
+  }
+
+  void run() {
+    while (running_.load(std::memory_order_relaxed)) {
+      const uint32_t seen = wake_.load(std::memory_order_acquire);
+      Write w;
+      while (writes_.pop(w)) {
+        if (w.time < chip_.time())
+          late_writes_.fetch_add(1, std::memory_order_relaxed);
+        if (!OPL_queueWrite(chip_.get(), w.time, w.reg, w.value))
+          dropped_writes_.fetch_add(1, std::memory_order_relaxed);
+      }
+      const std::size_t buffered = audio_.size() / 2;
+      if (buffered >= lead_) {
+        waitForReader(seen);
+        continue;
+      }
+      T *p;
+      std::size_t want = lead_ - buffered;
+      if (want > config_.block_frames)
+        want = config_.block_frames;
+      const std::size_t n = audio_.writeRegion(p, want * 2) / 2;
+      chip_.render(p, n);
+      audio_.commit(n * 2);
+    }
+  }
+};
+
+} // namespace opl
+
+#endif
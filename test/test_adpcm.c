@@ -0,0 +1,90 @@
+/**
+ * ADPCM round trip tests: encode then decode tracks the input, and encoded data uploaded to the chip plays back
+ * the decoder's samples from the first nibble on.
+ */
+#include "emu8950.h"
+#include "emuadpcm.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+  do {                                                                                                                 \
+    if (!(cond)) {                                                                                                     \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                                                  \
+      failures++;                                                                                                      \
+    }                                                                                                                  \
+  } while (0)
+
+#define MAX_SAMPLES 3001
+
+static int16_t pcm[MAX_SAMPLES], dec[MAX_SAMPLES];
+static uint8_t adpcm[MAX_SAMPLES / 2 + 1];
+
+static void make_pcm(uint32_t samples) {
+  uint32_t i;
+  for (i = 0; i < samples; i++)
+    pcm[i] = (int16_t)(12000 * sin(i * 0.05) + (i % 7) * 300);
+}
+
+static void test_encode_decode(uint32_t samples) {
+  uint32_t i, err = 0;
+
+  make_pcm(samples);
+  OPL_ADPCM_encode(pcm, samples, adpcm);
+  CHECK((adpcm[0] >> 4) == 0); /* pad nibble */
+  OPL_ADPCM_decode(adpcm, samples, dec);
+  for (i = samples / 4; i < samples; i++) {
+    const uint32_t d = (uint32_t)abs(dec[i] - pcm[i]);
+    if (err < d)
+      err = d;
+  }
+  CHECK(err < 2048);
+}
+
+/* play from START 0 and compare with the decoder through the unit's interpolation and volume */
+static void test_encode_playback(uint32_t samples) {
+  static int16_t out[MAX_SAMPLES + 128];
+  const uint32_t length = samples / 2 + 1;
+  const uint32_t stop = (length + 3) / 4; /* 4-byte units with 256k RAM */
+  OPL *opl = OPL_new(3579545, 44100);
+  uint32_t i, n = 0, mismatch = 0;
+
+  make_pcm(samples);
+  OPL_ADPCM_encode(pcm, samples, adpcm);
+  OPL_ADPCM_decode(adpcm, samples, dec);
+  CHECK(OPL_writeADPCMData(opl, 0, 0, length, adpcm) == 1);
+  OPL_writeReg(opl, 0x08, 0x00);
+  OPL_writeReg(opl, 0x09, 0x00);
+  OPL_writeReg(opl, 0x0A, 0x00);
+  OPL_writeReg(opl, 0x0B, stop & 0xff);
+  OPL_writeReg(opl, 0x0C, stop >> 8);
+  OPL_writeReg(opl, 0x12, 0xFF);
+  OPL_writeReg(opl, 0x10, 0xFF);
+  OPL_writeReg(opl, 0x11, 0xFF);
+  OPL_writeReg(opl, 0x07, 0x80);
+  while (n < samples)
+    n += OPL_ADPCM_calcNative(opl->adpcm, 100, out + n);
+  for (i = 0; i < samples; i++) {
+    const int32_t expect = ((dec[i] + (i ? dec[i - 1] : 0)) * 255) >> 13;
+    mismatch += out[i] != expect;
+  }
+  CHECK(mismatch == 0);
+  OPL_delete(opl);
+}
+
+int main(void) {
+  test_encode_decode(3000);
+  test_encode_decode(3001);
+  test_encode_playback(3000);
+  test_encode_playback(3001);
+
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("adpcm: ok\n");
+  return 0;
+}
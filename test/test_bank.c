@@ -0,0 +1,159 @@
+/**
+ * Instrument bank loader tests: valid files decode, truncated and malformed files are rejected.
+ */
+#include "emubank.h"
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+  do {                                                                                                                 \
+    if (!(cond)) {                                                                                                     \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                                                  \
+      failures++;                                                                                                      \
+    }                                                                                                                  \
+  } while (0)
+
+static void write16(uint8_t *p, uint32_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+
+static void write32(uint8_t *p, uint32_t v) {
+  write16(p, v);
+  write16(p + 2, v >> 16);
+}
+
+static void test_sbi(void) {
+  static uint8_t data[52];
+  OPL_BANK *bank;
+
+  memcpy(data, "SBI\x1a", 4);
+  memcpy(data + 4, "piano", 5);
+  data[36] = 0x21; /* modulator $20: EG, ML=1 */
+  data[47] = 0x0a; /* $C0: FB=5 */
+  data[46] = 0x0a;
+  bank = OPL_BANK_load(data, sizeof(data));
+  CHECK(bank != NULL);
+  if (bank) {
+    CHECK(bank->count == 1);
+    CHECK(strcmp(bank->name[0], "piano") == 0);
+    CHECK(bank->patch[0].op[0].ML == 1 && bank->patch[0].op[0].EG == 1);
+    CHECK(bank->patch[0].fb == 5);
+    OPL_BANK_delete(bank);
+  }
+
+  CHECK(OPL_BANK_load(data, 46) == NULL);
+  CHECK(OPL_BANK_load(data, 4) == NULL);
+}
+
+static void test_ibk(void) {
+  static uint8_t data[4 + 128 * 16 + 128 * 9];
+  OPL_BANK *bank;
+
+  memcpy(data, "IBK\x1a", 4);
+  data[4 + 5 * 16 + 1] = 0x03; /* instrument 5, carrier ML=3 */
+  memcpy(data + 4 + 128 * 16 + 5 * 9, "organ", 5);
+  bank = OPL_BANK_load(data, sizeof(data));
+  CHECK(bank != NULL);
+  if (bank) {
+    CHECK(bank->count == 128);
+    CHECK(bank->patch[5].op[1].ML == 3);
+    CHECK(strcmp(bank->name[5], "organ") == 0);
+    OPL_BANK_delete(bank);
+  }
+
+  CHECK(OPL_BANK_load(data, sizeof(data) - 1) == NULL);
+}
+
+/* BNK with two instruments: header, name table at 28, records at 52 */
+static uint32_t make_bnk(uint8_t *data) {
+  memset(data, 0, 28 + 2 * 12 + 2 * 30);
+  memcpy(data + 2, "ADLIB-", 6);
+  write16(data + 8, 2);
+  write32(data + 12, 28);
+  write32(data + 16, 28 + 2 * 12);
+  write16(data + 28, 1); /* first name points at the second record */
+  memcpy(data + 28 + 3, "bass", 4);
+  write16(data + 40, 0);
+  memcpy(data + 40 + 3, "lead", 4);
+  data[52 + 30 + 2 + 1] = 7; /* record 1, modulator multiple */
+  data[52 + 30 + 2 + 12] = 1; /* record 1, con: FM */
+  return 28 + 2 * 12 + 2 * 30;
+}
+
+static void test_bnk(void) {
+  static uint8_t data[256];
+  const uint32_t size = make_bnk(data);
+  OPL_BANK *bank;
+
+  bank = OPL_BANK_load(data, size);
+  CHECK(bank != NULL);
+  if (bank) {
+    CHECK(bank->count == 2);
+    CHECK(strcmp(bank->name[0], "bass") == 0 && strcmp(bank->name[1], "lead") == 0);
+    CHECK(bank->patch[0].op[0].ML == 7 && bank->patch[0].alg == 0);
+    CHECK(bank->patch[1].op[0].ML == 0 && bank->patch[1].alg == 1);
+    OPL_BANK_delete(bank);
+  }
+
+  CHECK(OPL_BANK_load(data, 27) == NULL);
+  CHECK(OPL_BANK_load(data, size - 1) == NULL); /* last record truncated */
+
+  /* offsets that wrap a 32-bit sum must not pass the bounds checks */
+  make_bnk(data);
+  write32(data + 12, 0xFFFFFFF8);
+  CHECK(OPL_BANK_load(data, size) == NULL);
+  make_bnk(data);
+  write32(data + 12, size + 1);
+  CHECK(OPL_BANK_load(data, size) == NULL);
+  make_bnk(data);
+  write16(data + 8, 0xFFFF);
+  CHECK(OPL_BANK_load(data, size) == NULL);
+  make_bnk(data);
+  write32(data + 16, 0xFFFFFFF0);
+  CHECK(OPL_BANK_load(data, size) == NULL);
+  make_bnk(data);
+  write16(data + 28, 0xFFFF); /* record index past the end */
+  CHECK(OPL_BANK_load(data, size) == NULL);
+}
+
+static void test_op2(void) {
+  static uint8_t data[8 + 175 * 36 + 175 * 32];
+  OPL_BANK *bank;
+
+  memcpy(data, "#OPL_II#", 8);
+  write16(data + 8 + 130 * 36, 1); /* instrument 130: fixed note */
+  data[8 + 130 * 36 + 3] = 60;
+  memcpy(data + 8 + 175 * 36 + 130 * 32, "snare", 5);
+  bank = OPL_BANK_load(data, sizeof(data));
+  CHECK(bank != NULL);
+  if (bank) {
+    CHECK(bank->count == 175);
+    CHECK(bank->drums != NULL && bank->drums[35 + 130 - 128].fixed_note == 60);
+    CHECK(strcmp(bank->name[130], "snare") == 0);
+    OPL_BANK_delete(bank);
+  }
+
+  CHECK(OPL_BANK_load(data, sizeof(data) - 1) == NULL);
+  CHECK(OPL_BANK_load(data, 8) == NULL);
+}
+
+int main(void) {
+  static const uint8_t unknown[64] = {'R', 'I', 'F', 'F'};
+
+  test_sbi();
+  test_ibk();
+  test_bnk();
+  test_op2();
+  CHECK(OPL_BANK_load(unknown, sizeof(unknown)) == NULL);
+  CHECK(OPL_BANK_load(unknown, 0) == NULL);
+
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("bank: ok\n");
+  return 0;
+}
@@ -0,0 +1,214 @@
+/**
+ * Timing tests: MIDI note-on latency across block sizes, write queue ordering, event prediction, IRQ offsets,
+ * dropped events and the mixing bus against a standalone chip.
+ */
+#include "emumidi.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+  do {                                                                                                                 \
+    if (!(cond)) {                                                                                                     \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);                                                  \
+      failures++;                                                                                                      \
+    }                                                                                                                  \
+  } while (0)
+
+#define CLOCK 3579545
+#define NATIVE_RATE (CLOCK / 72) /* one internal tick per output sample, no rate converter */
+
+static uint32_t rnd = 1;
+static uint32_t random_byte(void) {
+  rnd = rnd * 1103515245 + 12345;
+  return (rnd >> 16) & 0xff;
+}
+
+/* first output frame of a note-on at frame 500, rendered in blocks of `block` frames */
+static int32_t note_on_frame(uint32_t block) {
+  static int32_t buf[2 * 1000];
+  OPL *opl = OPL_new(CLOCK, 44100);
+  OPL_MIDI *midi = OPL_MIDI_new(opl);
+  uint32_t pos, i;
+  int32_t first = -1;
+
+  OPL_setChipType(opl, 2);
+  OPL_MIDI_noteOn(midi, 500, 0, 60, 127);
+  for (pos = 0; pos < 2000 && first < 0; pos += block) {
+    const uint32_t n = block < 1000 ? block : 1000;
+    OPL_calcStereoBlock(opl, buf, n, NULL, 0);
+    for (i = 0; i < n && first < 0; i++) {
+      if (buf[i * 2] != 0)
+        first = (int32_t)(pos + i);
+    }
+  }
+  OPL_MIDI_delete(midi);
+  OPL_delete(opl);
+  return first;
+}
+
+static void test_midi_latency(void) {
+  static const uint32_t blocks[] = {1, 17, 64, 256, 1000};
+  const int32_t first = note_on_frame(blocks[0]);
+  uint32_t i;
+
+  CHECK(first >= 500 && first < 500 + 32);
+  for (i = 1; i < sizeof(blocks) / sizeof(blocks[0]); i++) {
+    CHECK(note_on_frame(blocks[i]) == first);
+  }
+}
+
+static void render(OPL *opl, uint32_t samples) {
+  while (samples--)
+    OPL_calc(opl);
+}
+
+static void test_queue_order(void) {
+  OPL *opl = OPL_new(CLOCK, 44100);
+
+  /* same time: applied in the order queued */
+  OPL_queueWrite(opl, 10, 0xA0, 0x10);
+  OPL_queueWrite(opl, 10, 0xA0, 0x20);
+  /* queued later but due earlier */
+  OPL_queueWrite(opl, 20, 0xA1, 0x02);
+  OPL_queueWrite(opl, 15, 0xA1, 0x01);
+
+  render(opl, 10);
+  CHECK(opl->reg[0xA0] == 0 && opl->reg[0xA1] == 0);
+  render(opl, 1);
+  CHECK(opl->reg[0xA0] == 0x20);
+  render(opl, 5);
+  CHECK(opl->reg[0xA1] == 0x01);
+  render(opl, 5);
+  CHECK(opl->reg[0xA1] == 0x02);
+
+  /* a time already passed means the next sample */
+  OPL_queueWrite(opl, 3, 0xA2, 0x33);
+  CHECK(opl->reg[0xA2] == 0);
+  render(opl, 1);
+  CHECK(opl->reg[0xA2] == 0x33);
+  CHECK(opl->queue_len == 0);
+
+  OPL_delete(opl);
+}
+
+static int32_t irq_offset;
+static int irq_edges;
+static void on_irq(void *user, uint8_t irq, uint32_t offset) {
+  (void)user;
+  if (irq) {
+    irq_offset = (int32_t)offset;
+    irq_edges++;
+  }
+}
+
+static void test_timer_prediction(void) {
+  OPL *opl = OPL_new(CLOCK, NATIVE_RATE);
+  OPL_EVENT events[8];
+  int16_t out[16];
+  uint32_t count;
+
+  /* timer 1 at $FF overflows every 4 ticks */
+  OPL_writeReg(opl, 0x02, 0xFF);
+  OPL_writeReg(opl, 0x04, 0x19); /* start timer 1, keep EOS and BUF_RDY masked */
+  CHECK(OPL_nextEventCycles(opl) == 4 * 72);
+  render(opl, 1);
+  CHECK(OPL_nextEventCycles(opl) == 3 * 72);
+
+  /* the IRQ offset is the 0-based tick of the edge within the call */
+  OPL_setIRQCallback(opl, on_irq, NULL);
+  OPL_calcBlock(opl, out, 8, NULL, 0);
+  CHECK(irq_edges == 1 && irq_offset == 2);
+
+  /* block events are stored at their output sample */
+  OPL_writeReg(opl, 0x04, 0x80);
+  OPL_writeReg(opl, 0x04, 0x19); /* start timer 1, keep EOS and BUF_RDY masked */
+  count = OPL_calcBlock(opl, out, 6, events, 8);
+  CHECK(count == 2);
+  CHECK(events[0].type == OPL_EVENT_TIMER1 && events[0].offset == 3);
+  CHECK(events[1].type == OPL_EVENT_IRQ_ON && events[1].offset == 3);
+  CHECK(OPL_droppedEvents(opl) == 0);
+
+  OPL_delete(opl);
+}
+
+static void test_adpcm_prediction(void) {
+  static uint8_t ram[256];
+  OPL *opl = OPL_new(CLOCK, NATIVE_RATE);
+
+  OPL_writeADPCMData(opl, 0, 0, sizeof(ram), ram);
+  OPL_writeReg(opl, 0x09, 0x00);
+  OPL_writeReg(opl, 0x0B, 0x3F);
+  OPL_writeReg(opl, 0x10, 0x00);
+  OPL_writeReg(opl, 0x11, 0x80);
+  OPL_writeReg(opl, 0x07, 0x80);
+  CHECK(OPL_nextEventCycles(opl) != 0xFFFFFFFF);
+  OPL_setMask(opl, OPL_MASK_ADPCM);
+  CHECK(OPL_nextEventCycles(opl) == 0xFFFFFFFF);
+  OPL_delete(opl);
+}
+
+static void test_dropped_events(void) {
+  OPL *opl = OPL_new(CLOCK, NATIVE_RATE);
+  OPL_EVENT events[4];
+  int16_t out[100];
+  uint32_t count;
+
+  /* 25 timer overflows in 100 samples, the IRQ stays high after the first */
+  OPL_writeReg(opl, 0x02, 0xFF);
+  OPL_writeReg(opl, 0x04, 0x19); /* start timer 1, keep EOS and BUF_RDY masked */
+  count = OPL_calcBlock(opl, out, 100, events, 4);
+  CHECK(count == 4);
+  CHECK(OPL_droppedEvents(opl) == 25 + 1 - 4);
+  count = OPL_calcBlock(opl, out, 100, NULL, 0);
+  CHECK(count == 0 && OPL_droppedEvents(opl) == 0);
+  OPL_delete(opl);
+}
+
+static void test_bus_equivalence(void) {
+  static const uint32_t rates[] = {44100, 48000, NATIVE_RATE};
+  uint32_t k, n, i;
+
+  for (k = 0; k < sizeof(rates) / sizeof(rates[0]); k++) {
+    OPL *solo = OPL_new(CLOCK, rates[k]);
+    OPL *member = OPL_new(CLOCK, rates[k]);
+    OPL_BUS *bus = OPL_BUS_new(CLOCK, rates[k]);
+    long diff = 0;
+
+    CHECK(OPL_BUS_addChip(bus, member) == 0);
+    for (n = 0; n < 1000; n++) {
+      const uint32_t reg = random_byte(), val = random_byte();
+      if (reg <= 0x04 || reg == 0x07 || reg == 0x0F)
+        continue;
+      OPL_writeReg(solo, reg, val);
+      OPL_writeReg(member, reg, val);
+      for (i = random_byte() % 64; i > 0; i--) {
+        int32_t a[2], b[2];
+        OPL_calcStereo(solo, a);
+        OPL_BUS_calcStereo(bus, b);
+        diff += a[0] != b[0] || a[1] != b[1];
+      }
+    }
+    CHECK(diff == 0);
+    OPL_BUS_delete(bus);
+    OPL_delete(member);
+    OPL_delete(solo);
+  }
+}
+
+int main(void) {
+  test_midi_latency();
+  test_queue_order();
+  test_timer_prediction();
+  test_adpcm_prediction();
+  test_dropped_events();
+  test_bus_equivalence();
+
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("timing: ok\n");
+  return 0;
+}